@@ -33,6 +33,8 @@ rm -rf $RPM_BUILD_ROOT
 
 make DESTDIR=$RPM_BUILD_ROOT install
 mv $RPM_BUILD_ROOT/%{_libdir}/lcmaps/liblcmaps_condor_update.so $RPM_BUILD_ROOT/%{_libdir}/lcmaps/lcmaps_condor_update.mod
+%{_libexecdir}/%{name}/condor_update_helper
+%{_libexecdir}/%{name}/condor_discovery_daemon
 rm $RPM_BUILD_ROOT/%{_libdir}/lcmaps/liblcmaps_condor_update.la
 rm $RPM_BUILD_ROOT/%{_libdir}/lcmaps/liblcmaps_condor_update.a
 
@@ -42,6 +44,7 @@ rm -rf $RPM_BUILD_ROOT
 %files
 %defattr(-,root,root,-)
 %{_libdir}/lcmaps/lcmaps_condor_update.mod
+%{_libexecdir}/%{name}/condor_update_helper
 
 %changelog
 * Wed Aug 12 2015 Brian Bockelman <bbockelm@cse.unl.edu> - 0.2.1-1
@@ -0,0 +1,328 @@
+
+/*
+ * Benchmark for starter discovery against synthetic /proc trees.
+ * Reports the time taken by mineProc, makeAncestry, findCondorScratch and
+ * getParentIDs for a full snapshot, by the lazy ancestor walk, and by a
+ * refresh of an already populated cache (the "mine" column for refresh is
+ * refreshAncestry on a warm cache).  The cgroup row times discovery through
+ * the job's cgroup: "mine" is the two-level walk getParentIDs needs, and
+ * "scratch" is findCondorScratchByCgroup.  With -k, the job runs inside that
+ * many nested PID namespaces and the scratch column finds the chirp config
+ * passed into the innermost one.  The cache row is findCondorScratch through
+ * a warm node-wide discovery cache.  The uring row is the full scan with the
+ * status files read in batches through io_uring; the syscalls column is what
+ * the full scans spent reading status files (one openat, read and close each
+ * without io_uring).  The daemon row asks a discovery daemon that learns of
+ * a new glexec from a replayed fork event: "mine" is the daemon's initial
+ * scan, "scratch" the round trip, and "parent_ids" comes with the answer.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "condor_discovery.h"
+#include "discovery_daemon.h"
+#include "phase_stats.h"
+#include "fake_proc.h"
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: bench_discovery [-n processes[,processes...]] [-d depth] [-e environ_bytes] [-r repeats] [-t threads] [-c cgroup_version] [-k containers]\n");
+    exit(1);
+}
+
+struct Timings {
+    Timings() : mine(1e30), ancestry(1e30), scratch(1e30), parent_ids(1e30), syscalls(-1) {}
+    double mine, ancestry, scratch, parent_ids;
+    long syscalls; // -1 for rows that do not scan /proc in full.
+};
+
+static inline void keep_min(double &best, double start) {
+    double elapsed = now_us() - start;
+    if (elapsed < best) best = elapsed;
+}
+
+static void print_row(const FakeProcOptions &opts, const char *mode, const Timings &t) {
+    char syscalls[24] = "-";
+    if (t.syscalls >= 0) {
+        snprintf(syscalls, sizeof(syscalls), "%ld", t.syscalls);
+    }
+    printf("%9u %5u %8lu  %-7s %12.1f %12.1f %12.1f %12.1f %9s\n", opts.processes, opts.depth,
+           (unsigned long)opts.environ_size, mode, t.mine, t.ancestry, t.scratch, t.parent_ids, syscalls);
+}
+
+// A full scan, counting the system calls spent on status files.
+static void timed_scan(CondorAncestry &ca, Timings &t) {
+    stats_reset();
+    double start = now_us();
+    ca.mineProc();
+    keep_min(t.mine, start);
+    t.syscalls = stats_counter(STATS_SCAN_SYSCALLS);
+}
+
+static int check_scratch(char *scratch, const FakeProcTree &tree, bool by_cgroup = false) {
+    std::string expected = tree.execute_dir + "/dir_" + std::to_string(tree.starter);
+    if (!by_cgroup && !tree.chirp_config.empty()) {
+        expected = tree.chirp_config;
+    }
+    int rc = (!scratch || (expected != scratch));
+    if (rc) {
+        fprintf(stderr, "Wrong scratch directory: %s (expected %s)\n", scratch ? scratch : "(null)", expected.c_str());
+    }
+    free(scratch);
+    return rc;
+}
+
+struct DaemonThread {
+    DiscoveryDaemon *daemon;
+    volatile bool stop;
+};
+
+static void * serve_daemon(void *arg) {
+    DaemonThread *thread = (DaemonThread *)arg;
+    while (!thread->stop) {
+        thread->daemon->poll(10);
+    }
+    return NULL;
+}
+
+// A second glexec under the same payload as the leaf, which the daemon only
+// hears about through the fork event.
+static int time_daemon(const FakeProcOptions &opts, const FakeProcTree &tree, const ProcessEntry &leaf, Timings &t) {
+    DiscoveryDaemon daemon;
+    DaemonThread thread = {&daemon, false};
+    std::string socket_path = tree.root + "/discovery.sock";
+    pthread_t tid;
+    int events[2];
+    uid_t uid = 0;
+    gid_t gid = 0;
+    double start;
+    int rc = 0;
+
+    if (pipe(events)) {
+        perror("pipe");
+        return 1;
+    }
+    daemon.setReplay(events[0]);
+    start = now_us(); rc |= daemon.scan(); keep_min(t.mine, start);
+    t.ancestry = 0;
+    rc |= daemon.listen(socket_path.c_str());
+    pid_t pid = tree.leaf + 1;
+    while (addFakeProcess(tree, pid, leaf.ppid, leaf.uid, leaf.gid, "glexec")) {
+        pid++;
+    }
+    dprintf(events[1], "fork %d %d\n", leaf.ppid, pid);
+    if (rc || pthread_create(&tid, NULL, serve_daemon, &thread)) {
+        close(events[1]);
+        removeFakeProcess(tree, pid);
+        return 1;
+    }
+
+    setCondorDiscoveryDaemon(socket_path.c_str());
+    stats_reset();
+    start = now_us(); char *scratch = findCondorScratch(pid); keep_min(t.scratch, start);
+    rc |= check_scratch(scratch, tree);
+    start = now_us(); rc |= getParentIDs(pid, &uid, &gid); keep_min(t.parent_ids, start);
+    if (stats_counter(STATS_DAEMON_HITS) != 1) {
+        fprintf(stderr, "The discovery daemon did not answer\n");
+        rc = 1;
+    } else if ((uid != opts.user_uid) || (gid != opts.user_gid)) {
+        fprintf(stderr, "Wrong parent IDs from the discovery daemon: %d/%d\n", uid, gid);
+        rc = 1;
+    }
+    setCondorDiscoveryDaemon(NULL);
+    freeCondorAncestry();
+
+    dprintf(events[1], "exit %d\n", pid);
+    thread.stop = true;
+    pthread_join(tid, NULL);
+    close(events[1]);
+    removeFakeProcess(tree, pid);
+    return rc;
+}
+
+static int run(const FakeProcOptions &opts, unsigned repeats, int threads) {
+    FakeProcTree tree;
+    Timings full, threaded, uring, lazy, refresh, cgroup, cached, daemon;
+    uid_t uid;
+    gid_t gid;
+    double start;
+    int rc = 0;
+
+    start = now_us();
+    if (makeFakeProc(opts, tree)) {
+        perror("Unable to create the synthetic proc tree");
+        return 1;
+    }
+    fprintf(stderr, "Generated %u processes in %.0f ms\n", opts.processes, (now_us() - start) / 1e3);
+    setCondorProcRoot(tree.root.c_str());
+    setCondorScanUring(0);
+
+    for (unsigned idx = 0; idx < repeats && !rc; idx++) {
+        CondorAncestry ca;
+        PidList ancestry;
+        timed_scan(ca, full);
+        start = now_us(); rc |= ca.makeAncestry(tree.leaf, ancestry); keep_min(full.ancestry, start);
+        start = now_us(); char *scratch = ca.findCondorScratch(tree.leaf); keep_min(full.scratch, start);
+        rc |= check_scratch(scratch, tree);
+        start = now_us(); rc |= ca.getParentIDs(tree.leaf, &uid, &gid); keep_min(full.parent_ids, start);
+
+        if (threads > 1) {
+            CondorAncestry mt_ca;
+            PidList mt_ancestry;
+            setCondorScanThreads(threads);
+            timed_scan(mt_ca, threaded);
+            setCondorScanThreads(1);
+            start = now_us(); rc |= mt_ca.makeAncestry(tree.leaf, mt_ancestry); keep_min(threaded.ancestry, start);
+            start = now_us(); scratch = mt_ca.findCondorScratch(tree.leaf); keep_min(threaded.scratch, start);
+            rc |= check_scratch(scratch, tree);
+            start = now_us(); rc |= mt_ca.getParentIDs(tree.leaf, &uid, &gid); keep_min(threaded.parent_ids, start);
+            if (mt_ancestry != ancestry) {
+                fprintf(stderr, "Threaded scan disagrees with the serial scan\n");
+                rc = 1;
+            }
+        }
+
+        CondorAncestry uring_ca;
+        PidList uring_ancestry;
+        setCondorScanUring(1);
+        timed_scan(uring_ca, uring);
+        setCondorScanUring(0);
+        start = now_us(); rc |= uring_ca.makeAncestry(tree.leaf, uring_ancestry); keep_min(uring.ancestry, start);
+        start = now_us(); scratch = uring_ca.findCondorScratch(tree.leaf); keep_min(uring.scratch, start);
+        rc |= check_scratch(scratch, tree);
+        start = now_us(); rc |= uring_ca.getParentIDs(tree.leaf, &uid, &gid); keep_min(uring.parent_ids, start);
+        if ((uring_ancestry != ancestry) || (uring_ca.size() != ca.size())) {
+            fprintf(stderr, "io_uring scan disagrees with the serial scan\n");
+            rc = 1;
+        }
+
+        CondorAncestry lazy_ca;
+        PidList lazy_ancestry;
+        start = now_us(); rc |= lazy_ca.mineAncestry(tree.leaf); keep_min(lazy.mine, start);
+        start = now_us(); rc |= lazy_ca.makeAncestry(tree.leaf, lazy_ancestry); keep_min(lazy.ancestry, start);
+        start = now_us(); scratch = lazy_ca.findCondorScratch(tree.leaf); keep_min(lazy.scratch, start);
+        rc |= check_scratch(scratch, tree);
+        start = now_us(); rc |= lazy_ca.getParentIDs(tree.leaf, &uid, &gid); keep_min(lazy.parent_ids, start);
+
+        // The lazy walk does not record start times; the first refresh fills them in.
+        PidList refresh_ancestry;
+        rc |= lazy_ca.refreshAncestry(tree.leaf);
+        start = now_us(); rc |= lazy_ca.refreshAncestry(tree.leaf); keep_min(refresh.mine, start);
+        start = now_us(); rc |= lazy_ca.makeAncestry(tree.leaf, refresh_ancestry); keep_min(refresh.ancestry, start);
+        start = now_us(); scratch = lazy_ca.findCondorScratch(tree.leaf); keep_min(refresh.scratch, start);
+        rc |= check_scratch(scratch, tree);
+        start = now_us(); rc |= lazy_ca.getParentIDs(tree.leaf, &uid, &gid); keep_min(refresh.parent_ids, start);
+        if (refresh_ancestry != lazy_ancestry) {
+            fprintf(stderr, "Refreshed ancestry disagrees with the lazy walk\n");
+            rc = 1;
+        }
+
+        if (opts.cgroup_version) {
+            CondorAncestry cgroup_ca;
+            setCondorCgroupRoot(tree.cgroup_root.c_str());
+            start = now_us(); rc |= cgroup_ca.mineAncestry(tree.leaf, 1); keep_min(cgroup.mine, start);
+            cgroup.ancestry = 0;
+            start = now_us(); scratch = findCondorScratchByCgroup(tree.leaf); keep_min(cgroup.scratch, start);
+            rc |= check_scratch(scratch, tree, true);
+            start = now_us(); rc |= cgroup_ca.getParentIDs(tree.leaf, &uid, &gid); keep_min(cgroup.parent_ids, start);
+        }
+
+        // The first lookup fills the cache from the lazy walk.
+        std::string cache_path = tree.root + "/discovery.cache";
+        setCondorCgroupDiscovery(0);
+        if (setCondorDiscoveryCache(cache_path.c_str())) {
+            rc = 1;
+        }
+        rc |= check_scratch(findCondorScratch(tree.leaf), tree);
+        freeCondorAncestry();
+        cached.mine = cached.ancestry = cached.parent_ids = 0;
+        start = now_us(); scratch = findCondorScratch(tree.leaf); keep_min(cached.scratch, start);
+        rc |= check_scratch(scratch, tree);
+        setCondorDiscoveryCache(NULL);
+        setCondorCgroupDiscovery(1);
+        freeCondorAncestry();
+
+        const ProcessEntry *leaf = ca.find(tree.leaf);
+        rc |= !leaf || time_daemon(opts, tree, *leaf, daemon);
+    }
+    if (!rc && (uid != opts.user_uid || gid != opts.user_gid)) {
+        fprintf(stderr, "Wrong parent IDs: %d/%d\n", uid, gid);
+        rc = 1;
+    }
+
+    print_row(opts, "full", full);
+    if (threads > 1) {
+        char mode[16];
+        snprintf(mode, sizeof(mode), "full/%d", threads);
+        print_row(opts, mode, threaded);
+    }
+    print_row(opts, "uring", uring);
+    print_row(opts, "lazy", lazy);
+    print_row(opts, "refresh", refresh);
+    if (opts.cgroup_version) {
+        char mode[16];
+        snprintf(mode, sizeof(mode), "cgroup%d", opts.cgroup_version);
+        print_row(opts, mode, cgroup);
+    }
+    print_row(opts, "cache", cached);
+    print_row(opts, "daemon", daemon);
+    removeFakeProc(tree);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    FakeProcOptions opts;
+    std::vector<unsigned> sizes;
+    unsigned repeats = 3;
+    int threads = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:e:r:t:c:k:")) != -1) {
+        switch (opt) {
+        case 'n': {
+            char *list = optarg, *tok;
+            while ((tok = strsep(&list, ","))) {
+                sizes.push_back(strtoul(tok, NULL, 10));
+            }
+            break;
+        }
+        case 'd': opts.depth = strtoul(optarg, NULL, 10); break;
+        case 'e': opts.environ_size = strtoul(optarg, NULL, 10); break;
+        case 'r': repeats = strtoul(optarg, NULL, 10); break;
+        case 't': threads = atoi(optarg); break;
+        case 'c': opts.cgroup_version = atoi(optarg); break;
+        case 'k': opts.containers = strtoul(optarg, NULL, 10); break;
+        default: usage();
+        }
+    }
+    if (sizes.empty()) {
+        sizes.push_back(1000);
+        sizes.push_back(20000);
+    }
+
+    printf("%9s %5s %8s  %-7s %12s %12s %12s %12s %9s\n", "processes", "depth", "environ", "mode",
+           "mine (us)", "ancestry", "scratch", "parent_ids", "syscalls");
+    int rc = 0;
+    for (unsigned idx = 0; idx < sizes.size(); idx++) {
+        if (sizes[idx] < opts.depth + 5) {
+            fprintf(stderr, "Need at least %u processes for depth %u\n", opts.depth + 5, opts.depth);
+            return 1;
+        }
+        opts.processes = sizes[idx];
+        rc |= run(opts, repeats, threads);
+    }
+    return rc;
+}
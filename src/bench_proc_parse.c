@@ -0,0 +1,155 @@
+
+/*
+ * lcmaps-condor-update
+ * Microbenchmark for the /proc status parser: compares the per-process cost
+ * of the original strchr/malloc based parser with parse_proc_status() and
+ * parse_proc_stat().
+ * This code is under the public domain
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "proc_status.h"
+
+#define buf_size 4096
+
+/* The parser as it was before parse_proc_status(); kept here only as the
+   baseline for comparison. */
+static char * legacy_match_column(const char* key, const char *buf) {
+  const char *next_tab, *next_line;
+  const char *next_col = strchr(buf, '\t');
+  if (!next_col) {
+    return NULL;
+  }
+  if (strncmp(buf, key, (next_col-buf)) != 0) {
+    return NULL;
+  }
+  next_col++;
+  size_t column_len;
+  next_tab = strchr(next_col, '\t');
+  next_line = strchr(next_col, '\n');
+  if (!next_tab && !next_line) return NULL;
+  if (!next_line || (next_tab < next_line)) {
+    column_len = next_tab - next_col;
+  } else {
+    column_len = next_line - next_col;
+  }
+  char * result = (char *)malloc(column_len+1);
+  if (!result) return NULL;
+  result[column_len] = '\0';
+  strncpy(result, next_col, column_len);
+  return result;
+}
+
+static int legacy_parse(const char *buf, int *uid, int *gid, int *ppid) {
+  char *col;
+  *uid = -1;
+  *gid = -1;
+  *ppid = -1;
+  while (buf != NULL) {
+    if (*ppid == -1) {
+      if ((col = legacy_match_column("PPid:", buf))) {*ppid = strtol(col, NULL, 0); free(col);}
+    } else if (*uid == -1) {
+      if ((col = legacy_match_column("Uid:", buf))) {*uid = strtol(col, NULL, 0); free(col);}
+    } else if (*gid == -1) {
+      if ((col = legacy_match_column("Gid:", buf))) {*gid = strtol(col, NULL, 0); free(col);}
+      if (*gid != -1) return 0;
+    } else {
+      break;
+    }
+    buf = strchr(buf, '\n');
+    if (buf != NULL) {
+      buf++;
+      if (*buf == '\0') break;
+    }
+  }
+  return 1;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static ssize_t read_file(const char *path, char *buffer, size_t len) {
+  int fd;
+  ssize_t bytes;
+  if ((fd = open(path, O_RDONLY)) == -1) return -1;
+  bytes = read(fd, buffer, len);
+  close(fd);
+  return bytes;
+}
+
+#define ITERATIONS 200000
+#define READ_ITERATIONS 20000
+
+int main(int argc, char *argv[]) {
+  char status[buf_size], stat[512];
+  ssize_t status_len, stat_len;
+  int uid, gid, ppid, idx;
+  unsigned long long starttime;
+  double start, legacy_ns, status_ns, stat_ns;
+  volatile int sink = 0;
+
+  if ((status_len = read_file("/proc/self/status", status, buf_size-1)) <= 0 ||
+      (stat_len = read_file("/proc/self/stat", stat, sizeof(stat))) <= 0) {
+    fprintf(stderr, "Unable to read /proc/self: %d %s\n", errno, strerror(errno));
+    return 1;
+  }
+  status[status_len] = '\0';
+
+  if (legacy_parse(status, &uid, &gid, &ppid) || (ppid != getppid()) ||
+      parse_proc_status(status, status_len, &uid, &gid, &ppid) || (ppid != getppid()) || (uid != (int)getuid()) ||
+      parse_proc_stat(stat, stat_len, &ppid, &starttime) || (ppid != getppid())) {
+    fprintf(stderr, "Parsers disagree with getppid()/getuid()\n");
+    return 1;
+  }
+
+  start = now_ns();
+  for (idx = 0; idx < ITERATIONS; idx++) {legacy_parse(status, &uid, &gid, &ppid); sink += ppid;}
+  legacy_ns = (now_ns() - start) / ITERATIONS;
+  start = now_ns();
+  for (idx = 0; idx < ITERATIONS; idx++) {parse_proc_status(status, status_len, &uid, &gid, &ppid); sink += ppid;}
+  status_ns = (now_ns() - start) / ITERATIONS;
+  start = now_ns();
+  for (idx = 0; idx < ITERATIONS; idx++) {parse_proc_stat(stat, stat_len, &ppid, &starttime); sink += ppid;}
+  stat_ns = (now_ns() - start) / ITERATIONS;
+
+  printf("parse only (ns/process):\n");
+  printf("  legacy status parser  %8.1f\n", legacy_ns);
+  printf("  parse_proc_status     %8.1f\n", status_ns);
+  printf("  parse_proc_stat       %8.1f\n", stat_ns);
+
+  start = now_ns();
+  for (idx = 0; idx < READ_ITERATIONS; idx++) {
+    status_len = read_file("/proc/self/status", status, buf_size-1);
+    status[status_len] = '\0';
+    legacy_parse(status, &uid, &gid, &ppid); sink += ppid;
+  }
+  legacy_ns = (now_ns() - start) / READ_ITERATIONS;
+  start = now_ns();
+  for (idx = 0; idx < READ_ITERATIONS; idx++) {
+    status_len = read_file("/proc/self/status", status, buf_size);
+    parse_proc_status(status, status_len, &uid, &gid, &ppid); sink += ppid;
+  }
+  status_ns = (now_ns() - start) / READ_ITERATIONS;
+  start = now_ns();
+  for (idx = 0; idx < READ_ITERATIONS; idx++) {
+    stat_len = read_file("/proc/self/stat", stat, sizeof(stat));
+    parse_proc_stat(stat, stat_len, &ppid, &starttime); sink += ppid;
+  }
+  stat_ns = (now_ns() - start) / READ_ITERATIONS;
+
+  printf("open+read+parse (ns/process):\n");
+  printf("  legacy status parser  %8.1f\n", legacy_ns);
+  printf("  parse_proc_status     %8.1f\n", status_ns);
+  printf("  parse_proc_stat       %8.1f\n", stat_ns);
+  return 0;
+}
@@ -0,0 +1,148 @@
+
+/*
+ * lcmaps-condor-update
+ * Benchmark for the cost of starting the privilege-dropped child: fork()
+ * versus posix_spawn() as the resident size of the calling process grows,
+ * standing in for a glexec that has loaded LCMAPS, VOMS and other plugins.
+ * This code is under the public domain
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ITERATIONS 50
+#define MAX_SIZES 16
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void usage(void) {
+  fprintf(stderr, "Usage: bench_spawn [-s MiB[,MiB...]] [-n iterations] [-x program]\n");
+  exit(1);
+}
+
+static int reap(pid_t pid) {
+  int status;
+  if ((waitpid(pid, &status, 0) == -1) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+    fprintf(stderr, "Child %d did not exit cleanly\n", pid);
+    return 1;
+  }
+  return 0;
+}
+
+/* fork(); the child exits straight away. */
+static int time_fork(unsigned iterations, double *result) {
+  unsigned idx;
+  double start = now_us();
+  for (idx = 0; idx < iterations; idx++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      fprintf(stderr, "fork failed: %d %s\n", errno, strerror(errno));
+      return 1;
+    } else if (pid == 0) {
+      _exit(0);
+    }
+    if (reap(pid)) return 1;
+  }
+  *result = (now_us() - start) / iterations;
+  return 0;
+}
+
+/* fork() then exec the program, as the plugin does for condor_chirp. */
+static int time_fork_exec(unsigned iterations, const char *program, double *result) {
+  char * const child_argv[] = {(char *)program, NULL};
+  char * const child_env[] = {NULL};
+  unsigned idx;
+  double start = now_us();
+  for (idx = 0; idx < iterations; idx++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      fprintf(stderr, "fork failed: %d %s\n", errno, strerror(errno));
+      return 1;
+    } else if (pid == 0) {
+      execve(program, child_argv, child_env);
+      _exit(127);
+    }
+    if (reap(pid)) return 1;
+  }
+  *result = (now_us() - start) / iterations;
+  return 0;
+}
+
+/* posix_spawn() the program, as the plugin does for condor_update_helper. */
+static int time_spawn(unsigned iterations, const char *program, double *result) {
+  char * const child_argv[] = {(char *)program, NULL};
+  char * const child_env[] = {NULL};
+  unsigned idx;
+  int rc;
+  double start = now_us();
+  for (idx = 0; idx < iterations; idx++) {
+    pid_t pid;
+    if ((rc = posix_spawn(&pid, program, NULL, NULL, child_argv, child_env))) {
+      fprintf(stderr, "posix_spawn of %s failed: %d %s\n", program, rc, strerror(rc));
+      return 1;
+    }
+    if (reap(pid)) return 1;
+  }
+  *result = (now_us() - start) / iterations;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long sizes[MAX_SIZES] = {0, 64, 256, 1024};
+  unsigned nsizes = 4, iterations = DEFAULT_ITERATIONS, idx;
+  const char *program = "/bin/true";
+  double fork_us, fork_exec_us, spawn_us;
+  char *ballast = NULL;
+  int opt, rc = 0;
+
+  while ((opt = getopt(argc, argv, "s:n:x:")) != -1) {
+    switch (opt) {
+    case 's': {
+      char *list = optarg, *tok;
+      nsizes = 0;
+      while ((tok = strsep(&list, ",")) && (nsizes < MAX_SIZES)) {
+        sizes[nsizes++] = strtoul(tok, NULL, 10);
+      }
+      break;
+    }
+    case 'n': iterations = strtoul(optarg, NULL, 10); break;
+    case 'x': program = optarg; break;
+    default: usage();
+    }
+  }
+  if (!iterations) usage();
+
+  printf("%9s %12s %12s %12s\n", "rss (MiB)", "fork (us)", "fork+exec", "posix_spawn");
+  for (idx = 0; idx < nsizes; idx++) {
+    size_t bytes = sizes[idx] << 20;
+    free(ballast);
+    ballast = NULL;
+    // Touch every page so it is resident and has to be mapped by fork().
+    if (bytes && ((ballast = (char *)malloc(bytes)) == NULL)) {
+      fprintf(stderr, "Unable to allocate %lu MiB\n", sizes[idx]);
+      rc = 1;
+      break;
+    }
+    if (bytes) memset(ballast, 1, bytes);
+
+    if (time_fork(iterations, &fork_us) ||
+        time_fork_exec(iterations, program, &fork_exec_us) ||
+        time_spawn(iterations, program, &spawn_us)) {
+      rc = 1;
+      break;
+    }
+    printf("%9lu %12.1f %12.1f %12.1f\n", sizes[idx], fork_us, fork_exec_us, spawn_us);
+  }
+  free(ballast);
+  return rc;
+}
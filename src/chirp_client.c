@@ -0,0 +1,179 @@
+
+/*
+ * lcmaps-condor-update
+ * Native Chirp client; speaks just enough of the protocol to authenticate
+ * with the starter and update the job ClassAd.
+ * This code is under the public domain
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "lcmaps/lcmaps_modules.h"
+
+#include "chirp_client.h"
+#include "log_limit.h"
+
+static const char * logstr = "lcmaps-condor-update";
+
+#define CHIRP_LINE_MAX 4096
+#define CHIRP_HOST_MAX 256
+#define CHIRP_COOKIE_MAX 256
+
+/* Chirp arguments are whitespace-separated; escape embedded whitespace and
+   backslashes the same way the condor_chirp client does.  Returns the
+   number of bytes written, or -1 if the result does not fit. */
+static int chirp_escape(char *out, size_t outlen, const char *in) {
+  size_t pos = 0;
+  for (; *in; in++) {
+    if (isspace((unsigned char)*in) || (*in == '\\')) {
+      if (pos + 1 >= outlen) return -1;
+      out[pos++] = '\\';
+    }
+    if (pos + 1 >= outlen) return -1;
+    out[pos++] = *in;
+  }
+  out[pos] = '\0';
+  return pos;
+}
+
+static int chirp_write_all(int fd, const char *buf, size_t len) {
+  while (len) {
+    ssize_t written = write(fd, buf, len);
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buf += written;
+    len -= written;
+  }
+  return 0;
+}
+
+/* Read the single-integer response line that follows every command. */
+static int chirp_get_result(int fd, int *result) {
+  char line[64];
+  size_t pos = 0;
+  while (pos + 1 < sizeof(line)) {
+    ssize_t bytes = read(fd, line + pos, 1);
+    if (bytes == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (bytes == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    if (line[pos] == '\n') {
+      line[pos] = '\0';
+      if (sscanf(line, "%d", result) != 1) {
+        errno = EPROTO;
+        return -1;
+      }
+      return 0;
+    }
+    pos++;
+  }
+  errno = EPROTO;
+  return -1;
+}
+
+static int chirp_simple_command(int fd, const char *command, size_t len) {
+  int result;
+  if (chirp_write_all(fd, command, len) == -1) {
+    return -1;
+  }
+  if (chirp_get_result(fd, &result) == -1) {
+    return -1;
+  }
+  return (result < 0) ? -result : 0;
+}
+
+int chirp_client_connect(const char *path) {
+  char host[CHIRP_HOST_MAX], cookie[CHIRP_COOKIE_MAX], port_str[16];
+  char command[CHIRP_LINE_MAX], escaped[CHIRP_COOKIE_MAX*2];
+  struct addrinfo hints, *res, *ai;
+  int port, fd = -1, rc, len;
+  FILE *fp;
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    limited_log(0, "%s: Unable to open chirp config %s: %d %s\n", logstr, path, errno, strerror(errno));
+    return -1;
+  }
+  rc = fscanf(fp, "%255s %d %255s", host, &port, cookie);
+  fclose(fp);
+  if (rc != 3) {
+    limited_log(0, "%s: Malformed chirp config %s\n", logstr, path);
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  if ((rc = getaddrinfo(host, port_str, &hints, &res))) {
+    limited_log(0, "%s: Unable to resolve chirp server %s: %s\n", logstr, host, gai_strerror(rc));
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+  for (ai = res; ai; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) == -1) {
+      continue;
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd == -1) {
+    limited_log(0, "%s: Unable to connect to chirp server %s:%d: %d %s\n", logstr, host, port, errno, strerror(errno));
+    return -1;
+  }
+
+  if ((chirp_escape(escaped, sizeof(escaped), cookie) == -1) ||
+      ((len = snprintf(command, sizeof(command), "cookie %s\n", escaped)) >= (int)sizeof(command))) {
+    limited_log(0, "%s: Chirp cookie is overly long.\n", logstr);
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  if ((rc = chirp_simple_command(fd, command, len))) {
+    if (rc > 0) {
+      limited_log(0, "%s: Chirp server %s:%d rejected our cookie: %d\n", logstr, host, port, rc);
+      errno = EACCES;
+    } else {
+      limited_log(0, "%s: Chirp authentication with %s:%d failed: %d %s\n", logstr, host, port, errno, strerror(errno));
+    }
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int chirp_client_set_job_attr(int fd, const char *name, const char *expr) {
+  char command[CHIRP_LINE_MAX], escaped_name[CHIRP_LINE_MAX], escaped_expr[CHIRP_LINE_MAX];
+  int len;
+
+  if ((chirp_escape(escaped_name, sizeof(escaped_name), name) == -1) ||
+      (chirp_escape(escaped_expr, sizeof(escaped_expr), expr) == -1) ||
+      ((len = snprintf(command, sizeof(command), "set_job_attr %s %s\n", escaped_name, escaped_expr)) >= (int)sizeof(command))) {
+    limited_log(0, "%s: Chirp update of %s is overly long.\n", logstr, name);
+    errno = E2BIG;
+    return -1;
+  }
+  return chirp_simple_command(fd, command, len);
+}
+
+void chirp_client_close(int fd) {
+  close(fd);
+}
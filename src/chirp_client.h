@@ -0,0 +1,30 @@
+#ifndef __CHIRP_CLIENT_H
+#define __CHIRP_CLIENT_H
+
+/*
+ * Minimal native client for the subset of the Chirp protocol spoken by the
+ * condor_starter that this plugin needs: cookie authentication and
+ * set_job_attr.  Avoids an exec of condor_chirp per attribute.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Connect to the starter described by the chirp config file at path
+   ("host port cookie") and authenticate.  Returns a connected socket,
+   or -1 with errno set on failure. */
+int chirp_client_connect(const char *path);
+
+/* Set attribute name to the ClassAd expression expr in the job ad.
+   Returns 0 on success, a positive Chirp error code if the starter
+   rejected the request, or -1 with errno set on an I/O error. */
+int chirp_client_set_job_attr(int fd, const char *name, const char *expr);
+
+void chirp_client_close(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
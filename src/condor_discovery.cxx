@@ -2,205 +2,414 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <list>
+#include <stdint.h>
 #include <signal.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <syslog.h> 
 #include <errno.h>
 #include <dirent.h>
-
-#ifdef HAVE_UNORDERED_MAP
-#include <unordered_map>
-#else
-#include <ext/hash_map>
-#endif
+#include <pthread.h>
 
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
-#include <iostream>
+#include <stdlib.h>
 
 extern "C" {
 #include "lcmaps/lcmaps_log.h"
 }
 
+#include <algorithm>
+#include <vector>
+
 #include "condor_discovery.h"
+#include "proc_status.h"
+#include "environ_scan.h"
+#include "phase_stats.h"
+#include "discovery_cache.h"
+#include "discovery_client.h"
+#include "proc_uring.h"
+#include "log_limit.h"
 
-#define PROC "/proc"
 static const char * logstr = "condor_discovery";
 
+// Root of the proc filesystem; configurable so discovery can be exercised
+// against a synthetic process tree.
+static char proc_root[PATH_MAX] = "/proc";
+
+// Where the cgroup hierarchies are mounted, and whether to look there first.
+static char cgroup_root[PATH_MAX] = "/sys/fs/cgroup";
+static int cgroup_discovery = 1;
+
+// Socket of the discovery daemon; empty if there is none to ask.
+static char daemon_socket[PATH_MAX] = "";
+// The daemon is local and answers from memory; a slow answer means it is
+// wedged, and /proc is quicker.
+#define DAEMON_TIMEOUT_MS 100
+// The daemon's last answer, for getParentIDs of the same process.
+static discovery_reply_t daemon_reply;
+static pid_t daemon_reply_pid = 0;
+
 // Global variable
-class CondorAncestry;
 CondorAncestry *gCA;
 
-#ifdef HAVE_UNORDERED_MAP
-typedef std::unordered_map<pid_t, pid_t, std::hash<pid_t>, std::equal_to<pid_t> > PidPidMap;
-typedef std::unordered_map<pid_t, int, std::hash<pid_t>, std::equal_to<pid_t> > PidIntMap;
-#else
-struct eqpid {
-    bool operator()(const pid_t pid1, const pid_t pid2) const {
-        return pid1 == pid2;
-    }
-};  
-typedef __gnu_cxx::hash_map<pid_t, pid_t, __gnu_cxx::hash<pid_t>, eqpid> PidPidMap;
-typedef __gnu_cxx::hash_map<pid_t, int, __gnu_cxx::hash<pid_t>, eqpid> PidIntMap;
-#endif
-typedef std::list<pid_t> PidList;
-
-static char * match_column(const char* key, const char *buf) {
-    const char *next_tab, *next_line;
-    const char *next_col = strchr(buf, '\t');
-    if (!next_col) {
+
+#define buf_size 4096
+static int parse_proc_info(const char *buffer, ssize_t bytes, ProcessEntry *record) {
+    stats_count(STATS_PROCESSES, 1);
+    stats_count(STATS_BYTES_READ, bytes);
+    return parse_proc_status_ns(buffer, bytes, &record->uid, &record->gid, &record->ppid, &record->ns_pid, &record->ns_depth);
+}
+
+static int get_proc_info(int fd, ProcessEntry *record) {
+    char buffer[buf_size];
+    ssize_t bytes;
+    if ((bytes = read(fd, buffer, buf_size)) < 0) {
+        return -errno;
+    }
+    return parse_proc_info(buffer, bytes, record);
+}
+
+// Variables read from the starter's environment; all are looked up in one pass.
+enum {ENV_EXECUTE, ENV_CHIRP_CONFIG, ENV_SCRATCH_DIR, ENV_KEY_COUNT};
+static const char * const starter_env_keys[ENV_KEY_COUNT] = {"_CONDOR_EXECUTE", "_CONDOR_CHIRP_CONFIG", "_CONDOR_SCRATCH_DIR"};
+
+// Returns the environment block of pid, which the views point into; the caller must free it.
+static char * get_environ(pid_t pid, env_view_t *views) {
+    char path[PATH_MAX];
+    char *buf;
+    ssize_t len;
+    if (snprintf(path, sizeof(path), "%s/%d/environ", proc_root, pid) >= PATH_MAX) {
+        limited_log(0, "%s: Failure in building environ path for %d.\n", logstr, pid);
         return NULL;
     }
-    if (strncmp(buf, key, (next_col-buf)) != 0) {
+    if ((len = read_environ(path, &buf)) == -1) {
+        limited_log(0, "%s: Unable to read environ file %s: %d %s\n", logstr, path, errno, strerror(errno));
         return NULL;
     }
-    next_col++;
-    size_t column_len;
-    next_tab = strchr(next_col, '\t');
-    next_line = strchr(next_col, '\n');
-    if (!next_tab && !next_line) return NULL;
-    if (!next_line || (next_tab < next_line)) {
-        column_len = next_tab - next_col;
-    } else {
-        column_len = next_line - next_col;
+    stats_count(STATS_BYTES_READ, len);
+    environ_lookup(buf, len, starter_env_keys, ENV_KEY_COUNT, views);
+    return buf;
+}
+
+static int read_proc_status(pid_t pid, ProcessEntry *record) {
+    char path[PATH_MAX];
+    int fd, result;
+    if (snprintf(path, PATH_MAX, "%s/%d/status", proc_root, pid) >= PATH_MAX) {
+        limited_log(0, "%s: Error - overly long PID: %d\n", logstr, pid);
+        return -1;
     }
-    char * result = (char *)malloc(column_len+1);
-    result[column_len] = '\0';
-    if (!result) return NULL;
-    strncpy(result, next_col, column_len);
-    return result;
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        limited_log(0, "%s: Error opening process %d status file: %d %s\n", logstr, pid, errno, strerror(errno));
+        return -1;
+    }
+    if ((result = get_proc_info(fd, record))) {
+        limited_log(0, "%s: Error - unable to parse status file for PID %d: %d\n", logstr, pid, result);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
 }
 
-#define buf_size 4096
-static int get_proc_info(int fd, int *uid, int *gid, int *ppid) {
-    int retval = 0;
-    *uid = -1;
-    *gid = -1;
-    *ppid = -1;
-    const char *buf;
-    char buffer[buf_size]; buffer[buf_size-1] = '\0';
-    char * cuid, *cgid, *cppid;
-    if (read(fd, buffer, buf_size-1) < 0) {
-        retval = -errno;
-        goto finalize;
-    }
-    buf = buffer;
-    cuid = NULL;
-    cgid = NULL;
-    cppid = NULL;
-    while (buf != NULL) {
-        if (*ppid == -1) {
-            cppid = match_column("PPid:", buf);
-            if (cppid) {
-                errno = 0;
-                *ppid = strtol(cppid, NULL, 0);
-                free(cppid);
-                if (errno != 0) *ppid = -1;
-            }
-        } else if (*uid == -1) {
-            cuid = match_column("Uid:", buf);
-            if (cuid) {
-                errno = 0;
-                *uid = strtol(cuid, NULL, 0);
-                free(cuid);
-                if (errno != 0) *uid = -1;
-            }
-        } else if (*gid == -1) {
-            cgid = match_column("Gid:", buf);
-            if (cgid) { 
-                errno = 0;
-                *gid = strtol(cgid, NULL, 0);
-                free(cgid);
-                if (errno != 0) *gid = -1;
-            }
-            if (*gid != -1) {
-                retval = 0;
-                goto finalize;
-            }
-        } else {
-            break;
+// /proc/<pid>/stat is shorter and cheaper to generate than status; it has
+// the PPID and the start time, but not the UID/GID.
+static int read_proc_stat(pid_t pid, pid_t *ppid, unsigned long long *starttime) {
+    char path[PATH_MAX];
+    char buffer[512];
+    ssize_t bytes;
+    int fd;
+    if (snprintf(path, PATH_MAX, "%s/%d/stat", proc_root, pid) >= PATH_MAX) {
+        limited_log(0, "%s: Error - overly long PID: %d\n", logstr, pid);
+        return -1;
+    }
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        limited_log(0, "%s: Error opening process %d stat file: %d %s\n", logstr, pid, errno, strerror(errno));
+        return -1;
+    }
+    bytes = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if ((bytes < 0) || parse_proc_stat(buffer, bytes, ppid, starttime)) {
+        limited_log(0, "%s: Error - unable to parse stat file for PID %d\n", logstr, pid);
+        return -1;
+    }
+    stats_count(STATS_BYTES_READ, bytes);
+    return 0;
+}
+
+// Upper bound on the length of an ancestry chain; protects the lazy walk
+// against a (transient) loop in the parent links.
+#define MAX_ANCESTRY_DEPTH 1024
+
+// The init of a PID namespace nested below that of the proc root, e.g. an
+// Apptainer or Singularity container started with --pid.
+static inline bool isNamespaceRoot(const ProcessEntry *entry) {
+    return (entry->ns_depth > 0) && (entry->ns_pid == 1);
+}
+
+static int discovery_mode = CONDOR_DISCOVERY_LAZY;
+
+// Below this many processes per worker, threads cost more than they save.
+#define MIN_PIDS_PER_THREAD 256
+
+
+#define TABLE_MIN_CAPACITY 16
+
+// Entries are value-initialized by std::vector, so a zero pid marks a free slot.
+ProcessTable::ProcessTable() : slots(TABLE_MIN_CAPACITY), count(0), dense(false) {
+}
+
+size_t ProcessTable::slot(pid_t pid) const {
+    if (dense) {
+        return pid;
+    }
+    // Fibonacci hashing; the capacity is a power of two.
+    return ((uint32_t)pid * 2654435769U) & (slots.size() - 1);
+}
+
+const ProcessEntry * ProcessTable::find(pid_t pid) const {
+    if (pid <= 0) {
+        return NULL;
+    }
+    if (dense) {
+        return (((size_t)pid < slots.size()) && (slots[pid].pid == pid)) ? &slots[pid] : NULL;
+    }
+    for (size_t idx = slot(pid); ; idx = (idx + 1) & (slots.size() - 1)) {
+        if (slots[idx].pid == pid) {
+            return &slots[idx];
         }
-        buf = strchr(buf, '\n');
-        if (buf != NULL) {
-            buf++;
-            if (*buf == '\0') break;
+        if (slots[idx].pid == 0) {
+            return NULL;
         }
     }
-    retval = 1;
+}
+
+ProcessEntry * ProcessTable::insert(pid_t pid) {
+    if (dense && ((size_t)pid >= slots.size())) {
+        // Larger than the pid_max we were told about; fall back to hashing.
+        size_t capacity = TABLE_MIN_CAPACITY;
+        while (capacity < 2 * (count + 1)) {
+            capacity *= 2;
+        }
+        rehash(capacity, false);
+    } else if (!dense && (2 * (count + 1) > slots.size())) {
+        rehash(slots.size() * 2, false);
+    }
+    size_t idx = slot(pid);
+    if (!dense) {
+        while ((slots[idx].pid != pid) && (slots[idx].pid != 0)) {
+            idx = (idx + 1) & (slots.size() - 1);
+        }
+    }
+    if (slots[idx].pid != pid) {
+        slots[idx].pid = pid;
+        count++;
+    }
+    return &slots[idx];
+}
 
-finalize:
-    return retval;
+void ProcessTable::reserve(size_t expected, pid_t pid_max) {
+    size_t capacity = TABLE_MIN_CAPACITY;
+    while (capacity < 2 * expected) {
+        capacity *= 2;
+    }
+    // A dense array costs pid_max entries; worth it when that is not much
+    // more than the hash table would take anyway.
+    if ((pid_max > 0) && ((size_t)pid_max + 1 <= 2 * capacity)) {
+        rehash(pid_max + 1, true);
+    } else if (capacity > slots.size()) {
+        rehash(capacity, false);
+    }
+}
 
+void ProcessTable::rehash(size_t capacity, bool new_dense) {
+    std::vector<ProcessEntry> old_slots(capacity);
+    old_slots.swap(slots);
+    dense = new_dense;
+    count = 0;
+    for (size_t idx = 0; idx < old_slots.size(); idx++) {
+        if (old_slots[idx].pid > 0) {
+            *insert(old_slots[idx].pid) = old_slots[idx];
+        }
+    }
 }
 
-#define ENV_MAX 4096
-static char * get_environ(pid_t pid, const char * attr) {
-    char path[PATH_MAX];
-    if (snprintf(path, sizeof(path), "/proc/%d/environ", pid) >= PATH_MAX) {
-        lcmaps_log(0, "%s: Failure in building environ path for %d.\n", logstr, pid);
-        return NULL;
+void ProcessTable::erase(pid_t pid) {
+    if (pid <= 0) {
+        return;
     }
-    int fd;
-    if ((fd = open(path, O_RDONLY)) == -1) {
-        lcmaps_log(0, "%s: Unable to open environ file %s: %d %s\n", logstr, path, errno, strerror(errno));
-        return NULL;
+    if (dense) {
+        if (((size_t)pid < slots.size()) && (slots[pid].pid == pid)) {
+            slots[pid].pid = 0;
+            count--;
+        }
+        return;
     }
-    FILE * fp;
-    if ((fp = fdopen(fd, "r")) == NULL) {
-        lcmaps_log(0, "%s: Unable to reopen the environment fd: %d %s\n", logstr, errno, strerror(errno));
-        return NULL;
+    size_t mask = slots.size() - 1, hole = slot(pid);
+    while (slots[hole].pid != pid) {
+        if (slots[hole].pid == 0) {
+            return;
+        }
+        hole = (hole + 1) & mask;
     }
-    char *line = (char *)malloc(ENV_MAX+1);
-    if (!line) {fclose(fp); return NULL;}
-    size_t line_length = ENV_MAX;
-    ssize_t bytes_read;
-    size_t attr_len = strlen(attr), bytes_read2;
-    char * new_val = NULL;
-    while ((bytes_read = getdelim(&line, &line_length, '\0', fp)) > -1) {
-        bytes_read2 = (size_t)bytes_read;
-        if (bytes_read2 < attr_len+2)
-            continue;
-        line[attr_len] = '\0'; // Null out the equals sign
-        if (strcmp(line, attr) != 0)
-            continue;
-        const char * val = line + attr_len+1;
-        new_val = (char *)malloc(strlen(val)+1);
-        if (!new_val) {fclose(fp); return NULL;}
-        strcpy(new_val, val);
-        break;
+    // Backward-shift deletion: pull later entries of the run into the hole
+    // when their own slot is at or before it, so no probe sequence is broken.
+    for (size_t idx = (hole + 1) & mask; slots[idx].pid != 0; idx = (idx + 1) & mask) {
+        size_t home = slot(slots[idx].pid);
+        if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+            slots[hole] = slots[idx];
+            hole = idx;
+        }
+    }
+    slots[hole].pid = 0;
+    count--;
+}
+
+void ProcessTable::pids(std::vector<pid_t> &result) const {
+    for (size_t idx = 0; idx < slots.size(); idx++) {
+        if (slots[idx].pid > 0) {
+            result.push_back(slots[idx].pid);
+        }
+    }
+}
+
+void ProcessTable::clear() {
+    std::vector<ProcessEntry>(TABLE_MIN_CAPACITY).swap(slots);
+    count = 0;
+    dense = false;
+}
+
+static pid_t read_pid_max() {
+    char path[PATH_MAX];
+    pid_t pid_max = 0;
+    FILE *fp;
+    if (snprintf(path, PATH_MAX, "%s/sys/kernel/pid_max", proc_root) >= PATH_MAX) {
+        return 0;
+    }
+    if ((fp = fopen(path, "r")) == NULL) {
+        return 0;
+    }
+    if (fscanf(fp, "%d", &pid_max) != 1) {
+        pid_max = 0;
     }
     fclose(fp);
-    free(line);
-    return new_val;
+    return pid_max;
 }
 
-class CondorAncestry {
+// A process that could not be read during a full scan.  Scan workers do not
+// log; errors are summarized by the scanning thread once the workers are done.
+struct ScanError {
+    pid_t pid;
+    int open_errno;   // Non-zero if the status file could not be opened.
+    int parse_result; // Result of get_proc_info otherwise.
+};
+
+// How scan errors are counted.  A process that exits between readdir and the
+// read of its status file is normal on a busy node; the rest are not.
+enum {SCAN_VANISHED, SCAN_UNREADABLE, SCAN_UNPARSABLE, SCAN_ERROR_KINDS};
 
-public:
-    char * findCondorScratch(pid_t); // Note: Caller takes ownership of returned pointer on heap.
-    int makeAncestry(pid_t, PidList&);
-    int mineProc();
-    int getParentIDs(pid_t, uid_t*, gid_t*);
+static int scan_error_kind(const ScanError &err) {
+    int code = err.open_errno ? err.open_errno : -err.parse_result;
+    if ((code == ENOENT) || (code == ESRCH)) {
+        return SCAN_VANISHED;
+    }
+    return (code > 0) ? SCAN_UNREADABLE : SCAN_UNPARSABLE;
+}
 
-private:
-    PidPidMap reverse_parentage_mapping;
-    PidIntMap process_uid_mapping;
-    PidIntMap process_gid_mapping;
+struct ScanSlice {
+    int dfd;
+    const pid_t *pids;
+    size_t count;
+    std::vector<ProcessEntry> records;
+    std::vector<ScanError> errors;
+    std::vector<bool> done; // Files already read through io_uring.
 };
 
+// Status files read at once by each scan thread's ring.
+#define URING_DEPTH 64
+
+static int scan_uring = 1;
+
+// Completion of one status file read through io_uring.
+static void scan_status(void *arg, size_t idx, int open_errno, const char *buf, ssize_t len) {
+    ScanSlice *slice = static_cast<ScanSlice *>(arg);
+    ProcessEntry record;
+    ScanError error;
+    record.pid = slice->pids[idx];
+    record.starttime = 0;
+    slice->done[idx] = true;
+    int result = open_errno ? 0 : ((len < 0) ? len : parse_proc_info(buf, len, &record));
+    if (open_errno || result) {
+        error.pid = record.pid;
+        error.open_errno = open_errno;
+        error.parse_result = result;
+        slice->errors.push_back(error);
+        return;
+    }
+    slice->records.push_back(record);
+}
+
+static void * scan_slice(void *arg) {
+    ScanSlice *slice = static_cast<ScanSlice *>(arg);
+    slice->records.reserve(slice->count);
+    proc_uring_t *ring;
+    if (scan_uring && (slice->count > 1) && (ring = proc_uring_open(URING_DEPTH))) {
+        slice->done.assign(slice->count, false);
+        size_t read = proc_uring_read(ring, slice->dfd, slice->pids, slice->count, "status", scan_status, slice);
+        proc_uring_close(ring);
+        if (read == slice->count) {
+            return NULL;
+        }
+    }
+    // Without io_uring, or for whatever it did not get to.
+    for (size_t idx = 0; idx < slice->count; idx++) {
+        char path[32];
+        ProcessEntry record;
+        ScanError error;
+        if (!slice->done.empty() && slice->done[idx]) {
+            continue;
+        }
+        record.pid = slice->pids[idx];
+        record.starttime = 0;
+        snprintf(path, sizeof(path), "%d/status", record.pid);
+        stats_count(STATS_SCAN_SYSCALLS, 1);
+        int fd = openat(slice->dfd, path, O_RDONLY);
+        if (fd == -1) {
+            error.pid = record.pid;
+            error.open_errno = errno;
+            error.parse_result = 0;
+            slice->errors.push_back(error);
+            continue;
+        }
+        stats_count(STATS_SCAN_SYSCALLS, 2);
+        int result = get_proc_info(fd, &record);
+        close(fd);
+        if (result) {
+            error.pid = record.pid;
+            error.open_errno = 0;
+            error.parse_result = result;
+            slice->errors.push_back(error);
+            continue;
+        }
+        slice->records.push_back(record);
+    }
+    return NULL;
+}
+
+static int scan_threads = 1;
+
 int CondorAncestry::mineProc() {
     DIR * dirp;
     struct dirent64 *dp;
     const char * name;
-    if ((dirp = opendir(PROC)) == NULL) {
-        lcmaps_log(0, "%s: Error - Unable to open /proc: %d %s\n", logstr, errno, strerror(errno));
+    if ((dirp = opendir(proc_root)) == NULL) {
+        limited_log(0, "%s: Error - Unable to open %s: %d %s\n", logstr, proc_root, errno, strerror(errno));
         return errno;
     }
     int dfd = dirfd(dirp);
     int proc;
+    std::vector<pid_t> pids;
     do {
         errno = 0;
         if ((dp = readdir64(dirp)) != NULL) {
@@ -209,52 +418,295 @@ int CondorAncestry::mineProc() {
             name = dp->d_name;
             if (sscanf(name, "%d", &proc) != 1)
                 continue;
-            char path[PATH_MAX];
-            if (snprintf(path, sizeof(path), "%s/status", name) >= PATH_MAX) {
-                lcmaps_log(0, "%s: Error - overly long directory file name: %s %ld\n", logstr, name, strlen(name));
-                continue;
-            }
-            int fd = openat(dfd, path, O_RDONLY);
-            if (fd == -1) {
-                lcmaps_log(0, "%s: Error - unable to open PID %s status file: %d %s\n", logstr, name, errno, strerror(errno));
-                continue;
-            }
-            int uid, gid, result;
-            pid_t ppid;
-            if ((result = get_proc_info(fd, &uid, &gid, &ppid))) {
-                lcmaps_log(0, "%s: Error - unable to parse status file for PID %s: %d\n", logstr, name, result);
-                close(fd);
-                continue;
-            }
-            close(fd);
-            //std::cout << "Running process: " << name << " (uid=" << uid << ", gid=" << gid << ", ppid= " << ppid << ")" << std::endl;
-            //lcmaps_log(0, "%s: Running process %s (uid=%d, gid=%d, ppid=%d)\n", name, uid, gid, ppid);
-            reverse_parentage_mapping[proc] = ppid;
-            process_uid_mapping[proc] = uid;
-            process_gid_mapping[proc] = gid;
+            pids.push_back(proc);
         }
     } while (dp != NULL);
 
     if (errno != 0) {
-        lcmaps_log(0, "%s: Error reading /proc directory: %d %s\n", logstr, errno, strerror(errno));
+        limited_log(0, "%s: Error reading %s directory: %d %s\n", logstr, proc_root, errno, strerror(errno));
+    }
+
+    // Anything cached from an earlier query may be stale.
+    processes.clear();
+    child_index.clear();
+    have_children = false;
+
+    // Split the directory entries into contiguous slices, one per worker; the
+    // first slice is scanned by this thread.  Merging the slices in order gives
+    // the same result as a serial scan.
+    size_t nslices = scan_threads;
+    if (nslices > pids.size() / MIN_PIDS_PER_THREAD) {
+        nslices = pids.size() / MIN_PIDS_PER_THREAD;
+    }
+    if (nslices < 1) {
+        nslices = 1;
+    }
+    std::vector<ScanSlice> slices(nslices);
+    std::vector<pthread_t> threads(nslices);
+    std::vector<bool> started(nslices, false);
+    size_t per_slice = pids.size() / nslices, offset = 0;
+    for (size_t idx = 0; idx < nslices; idx++) {
+        slices[idx].dfd = dfd;
+        slices[idx].pids = pids.empty() ? NULL : &pids[offset];
+        slices[idx].count = (idx == nslices - 1) ? (pids.size() - offset) : per_slice;
+        offset += slices[idx].count;
+    }
+    for (size_t idx = 1; idx < nslices; idx++) {
+        int rc;
+        if ((rc = pthread_create(&threads[idx], NULL, scan_slice, &slices[idx]))) {
+            limited_log(0, "%s: Unable to start scan thread: %d %s\n", logstr, rc, strerror(rc));
+            scan_slice(&slices[idx]);
+        } else {
+            started[idx] = true;
+        }
+    }
+    scan_slice(&slices[0]);
+    for (size_t idx = 1; idx < nslices; idx++) {
+        if (started[idx]) {
+            pthread_join(threads[idx], NULL);
+        }
     }
     closedir(dirp);
+
+    size_t total = 0;
+    for (size_t idx = 0; idx < nslices; idx++) {
+        total += slices[idx].records.size();
+    }
+    processes.reserve(total, read_pid_max());
+    child_index.reserve(total);
+    size_t error_counts[SCAN_ERROR_KINDS] = {0};
+    for (size_t idx = 0; idx < nslices; idx++) {
+        std::vector<ScanError>::const_iterator err;
+        for (err = slices[idx].errors.begin(); err != slices[idx].errors.end(); err++) {
+            error_counts[scan_error_kind(*err)]++;
+            if (err->open_errno) {
+                lcmaps_log_debug(3, "%s: Unable to open PID %d status file: %d %s\n", logstr, err->pid, err->open_errno, strerror(err->open_errno));
+            } else if (err->parse_result < 0) {
+                lcmaps_log_debug(3, "%s: Unable to read PID %d status file: %d %s\n", logstr, err->pid, -err->parse_result, strerror(-err->parse_result));
+            } else {
+                lcmaps_log_debug(3, "%s: Unable to parse status file for PID %d\n", logstr, err->pid);
+            }
+        }
+        std::vector<ProcessEntry>::const_iterator rec;
+        for (rec = slices[idx].records.begin(); rec != slices[idx].records.end(); rec++) {
+            *processes.insert(rec->pid) = *rec;
+            child_index.push_back(std::make_pair(rec->ppid, rec->pid));
+        }
+    }
+    // One line for the whole scan; processes that exited under it are only
+    // worth a debug message.
+    if (error_counts[SCAN_UNREADABLE] || error_counts[SCAN_UNPARSABLE]) {
+        limited_log(0, "%s: Error - scan of %s skipped %lu unreadable and %lu unparsable status files (%lu processes read, %lu exited during the scan)\n",
+                    logstr, proc_root, (unsigned long)error_counts[SCAN_UNREADABLE], (unsigned long)error_counts[SCAN_UNPARSABLE],
+                    (unsigned long)total, (unsigned long)error_counts[SCAN_VANISHED]);
+    } else if (error_counts[SCAN_VANISHED]) {
+        lcmaps_log_debug(2, "%s: %lu processes exited during the scan of %s\n", logstr,
+                         (unsigned long)error_counts[SCAN_VANISHED], proc_root);
+    }
+    std::sort(child_index.begin(), child_index.end());
+    have_children = true;
+    have_snapshot = true;
+    return 0;
+}
+
+int CondorAncestry::mineAncestry(pid_t pid, unsigned max_levels) {
+    /* Lazy alternative to mineProc: rather than reading the status file of
+       every process on the node, follow the parent links up from pid to init,
+       reading one status file per ancestor not already known.  The cost
+       depends on the depth of the process tree, not on its size.
+     */
+    pid_t curpid = pid;
+    const ProcessEntry *entry;
+    unsigned depth = 0;
+    while (true) {
+        pid_t ppid;
+        if ((entry = processes.find(curpid))) {
+            ppid = entry->ppid;
+        } else {
+            ProcessEntry record;
+            record.pid = curpid;
+            record.starttime = 0;
+            if (read_proc_status(curpid, &record)) {
+                limited_log(0, "%s: Unable to read ancestor %d of %d.\n", logstr, curpid, pid);
+                return 1;
+            }
+            ProcessEntry *inserted = processes.insert(curpid);
+            *inserted = record;
+            entry = inserted;
+            ppid = record.ppid;
+        }
+        // PID 1 is init; in a PID namespace, the namespace root reports a PPID of 0.
+        if ((curpid == 1) || (ppid <= 0)) {
+            break;
+        }
+        // A container's init usually carries the chirp config; findCondorScratch
+        // extends the walk past it only if it does not.
+        if ((curpid != pid) && isNamespaceRoot(entry)) {
+            break;
+        }
+        if (++depth > MAX_ANCESTRY_DEPTH) {
+            limited_log(0, "%s: Error - ancestry of %d exceeds %d processes; possible loop.\n", logstr, pid, MAX_ANCESTRY_DEPTH);
+            return 1;
+        }
+        if (max_levels && (depth > max_levels)) {
+            break;
+        }
+        curpid = ppid;
+    }
+    return 0;
+}
+
+int CondorAncestry::refreshAncestry(pid_t pid, unsigned max_levels) {
+    /* Like mineAncestry, but cached entries are not trusted: a process may
+       have exited and its PID been reused, or been reparented.  Each ancestor
+       costs a read of its stat file, for the current PPID and start time; the
+       status file is only re-read when the start time does not match the
+       cached entry, i.e. for new or replaced processes.
+     */
+    pid_t curpid = pid;
+    const ProcessEntry *entry;
+    unsigned depth = 0;
+    while (true) {
+        if ((entry = refreshProcess(curpid)) == NULL) {
+            limited_log(0, "%s: Unable to read ancestor %d of %d.\n", logstr, curpid, pid);
+            return 1;
+        }
+        pid_t ppid = entry->ppid;
+        // PID 1 is init; in a PID namespace, the namespace root reports a PPID of 0.
+        if ((curpid == 1) || (ppid <= 0)) {
+            break;
+        }
+        if ((curpid != pid) && isNamespaceRoot(entry)) {
+            break;
+        }
+        if (++depth > MAX_ANCESTRY_DEPTH) {
+            limited_log(0, "%s: Error - ancestry of %d exceeds %d processes; possible loop.\n", logstr, pid, MAX_ANCESTRY_DEPTH);
+            return 1;
+        }
+        if (max_levels && (depth > max_levels)) {
+            break;
+        }
+        curpid = ppid;
+    }
     return 0;
 }
 
+const ProcessEntry * CondorAncestry::refreshProcess(pid_t pid) {
+    pid_t ppid;
+    unsigned long long starttime;
+    ProcessEntry *entry;
+    if (read_proc_stat(pid, &ppid, &starttime)) {
+        return NULL;
+    }
+    const ProcessEntry *cached = processes.find(pid);
+    if (!cached || (cached->starttime != starttime)) {
+        ProcessEntry record;
+        unsigned long long check_starttime;
+        record.pid = pid;
+        record.starttime = starttime;
+        // Re-check the start time after the status read, in case the PID
+        // was reused in between.
+        if (read_proc_status(pid, &record) ||
+            read_proc_stat(pid, &ppid, &check_starttime)) {
+            return NULL;
+        }
+        if (check_starttime != starttime) {
+            limited_log(0, "%s: Error - process %d was replaced while being read.\n", logstr, pid);
+            return NULL;
+        }
+        entry = processes.insert(pid);
+        *entry = record;
+        // The child index no longer matches the table.
+        have_children = false;
+    } else {
+        entry = processes.insert(pid);
+    }
+    if (entry->ppid != ppid) {
+        have_children = false;
+    }
+    entry->ppid = ppid;
+    return entry;
+}
+
+void CondorAncestry::addChild(pid_t parent, pid_t child) {
+    const ProcessEntry *entry = processes.find(parent);
+    have_children = false;
+    if (!entry) {
+        // Whatever had the child's PID before is gone.
+        processes.erase(child);
+        return;
+    }
+    ProcessEntry record = *entry;
+    record.pid = child;
+    record.ppid = parent;
+    record.starttime = 0;
+    // Unknown: the child may have been cloned into a new PID namespace.
+    record.ns_pid = -1;
+    *processes.insert(child) = record;
+}
+
+void CondorAncestry::removeProcess(pid_t pid) {
+    processes.erase(pid);
+    have_children = false;
+}
+
+void CondorAncestry::setIDs(pid_t pid, int uid, int gid) {
+    ProcessEntry *entry;
+    if (!processes.find(pid)) {
+        return;
+    }
+    entry = processes.insert(pid);
+    if (uid != -1) {
+        entry->uid = uid;
+    }
+    if (gid != -1) {
+        entry->gid = gid;
+    }
+}
+
+// Start time of pid, read just before its environment; 0 if unavailable.
+static unsigned long long source_starttime(pid_t pid, const ProcessEntry *source) {
+    pid_t ppid;
+    unsigned long long starttime;
+    if (!source || read_proc_stat(pid, &ppid, &starttime)) {
+        return 0;
+    }
+    return starttime;
+}
+
+// Records the process a result was derived from, for the discovery cache,
+// provided it is still the process whose environment was read.
+static void set_source(ProcessEntry *source, pid_t pid, int uid, int gid, unsigned long long starttime) {
+    pid_t ppid;
+    unsigned long long check_starttime;
+    if (!source || !starttime || read_proc_stat(pid, &ppid, &check_starttime) || (check_starttime != starttime)) {
+        return;
+    }
+    source->pid = pid;
+    source->ppid = ppid;
+    source->uid = uid;
+    source->gid = gid;
+    source->starttime = starttime;
+}
+
 int CondorAncestry::makeAncestry(pid_t pid, PidList& ancestry) {
-    // TODO
+    // The chain ends at init, or at the root of the proc root's PID namespace
+    // (PPID 0).  Past a nested namespace root, the lazy walk may not have
+    // gone any further; the chain then ends there.
     pid_t curpid = pid;
-    PidPidMap::const_iterator it;
+    const ProcessEntry *entry;
     int result = 0;
     while (curpid != 1) {
         ancestry.push_back(curpid);
-        if ((it = reverse_parentage_mapping.find(curpid)) == reverse_parentage_mapping.end()) {
+        if ((entry = processes.find(curpid)) == NULL) {
             result = 1;
-            lcmaps_log(0, "%s: Unable to find parent of %d, ancestor of %d.\n", logstr, curpid, pid);
+            limited_log(0, "%s: Unable to find parent of %d, ancestor of %d.\n", logstr, curpid, pid);
+            break;
+        }
+        if ((entry->ppid <= 0) || ((curpid != pid) && isNamespaceRoot(entry) && !processes.find(entry->ppid))) {
             break;
         }
-        curpid = it->second;
+        curpid = entry->ppid;
     }
     if (curpid == 1) {
         ancestry.push_back(1);
@@ -262,60 +714,82 @@ int CondorAncestry::makeAncestry(pid_t pid, PidList& ancestry) {
     return result;
 }
 
-char * CondorAncestry::findCondorScratch(pid_t pid) {
-    /* General algorithm:
-       1) Create a PidList "ancestry" where ancestry[0] = pid, ancestry[-1] = 1, and ancestry[n]'s PPID is ancestry[n+1]
-       2) Set idx=0, orig_uid=uid(ancestry[0]), scratchdir to NULL
-       3) If uid(ancestry[idx]) != orig_uid, return scratchdir
-       4) Update scratchdir to _CONDOR_SCRATCH_DIR from ancestry[idx] if it exists
-       5) Increment idx by one; goto 3.
+char * CondorAncestry::findCondorScratch(pid_t pid, ProcessEntry *source) {
+    /* General algorithm: walk up from the parent of pid (the glexec
+       invocation) until one of:
+       1) A root-owned process: the starter.  The scratch directory is
+          dir_<starter PID> under its _CONDOR_EXECUTE.
+       2) The init of a PID namespace (a container): its _CONDOR_CHIRP_CONFIG,
+          or _CONDOR_SCRATCH_DIR, is passed through to the job inside, and
+          is valid in the container's view of the file system.  If it has
+          neither, carry on into the enclosing namespace; nested containers
+          are walked one at a time.
+       3) The top of the visible tree (init, or a PPID of 0 when /proc is
+          that of a container): as 2), but there is nowhere further to go.
      */
-    PidList ancestry;
-    int rc;
-    if ((rc = makeAncestry(pid, ancestry))) {
-        lcmaps_log(0, "%s: Error: unable to determine ancestry of %d: %d\n", logstr, pid, rc);
+    const ProcessEntry *entry;
+    if (source) {
+        source->pid = 0;
+    }
+    if ((entry = processes.find(pid)) == NULL) {
+        limited_log(0, "%s: Error: unable to determine ancestry of %d.\n", logstr, pid);
         return NULL;
     }
-
-    if (ancestry.size() < 2) { // pid, starter, startd, master, init are required!
-        // For PID namespaces, this might just be PID, namespace_starter.
-        lcmaps_log(0, "%s: Error - ancestry of %d is implausibly small (found chain of length %lu).\n", logstr, pid, ancestry.size());
+    if ((pid == 1) || (entry->ppid <= 0)) {
+        limited_log(0, "%s: Error - ancestry of %d is implausibly small (found chain of length 1).\n", logstr, pid);
         return NULL;
     }
-    PidList::const_iterator it;
-    PidIntMap::const_iterator it2;
-    it = ancestry.begin();
-    it++; // skip the glexec invocation.
-    for (; it != ancestry.end(); it++) {
-        if ((it2 = process_uid_mapping.find(*it)) == process_uid_mapping.end()) {
-            lcmaps_log(0, "%s: Error - ancestor %d is not in UID map.\n", logstr, *it);
-            return NULL; // If we don't know the UID of an ancestor, something fishy is happening.  Bail.
-        }
-        int uid = it2->second;
-        if ((uid == 0) || (*it == 1)) { // Welcome to your starter!
-            char * execute_dir = (uid == 0) ? get_environ(*it, "_CONDOR_EXECUTE") : get_environ(*it, "_CONDOR_CHIRP_CONFIG");
-            if (!execute_dir) {
-                if (uid == 0) {lcmaps_log(0, "%s: Error - unable to find _CONDOR_EXECUTE from starter %d environment\n", logstr, *it);}
-                else {lcmaps_log(0, "%s: Error - unable to find _CONDOR_CHIRP_CONFIG from starter %d environment.\n", logstr, *it);}
-                return NULL;
-            }
-            if (uid != 0)
-            {
-                return execute_dir;
+    pid_t curpid = entry->ppid;
+    for (unsigned depth = 0; depth < MAX_ANCESTRY_DEPTH; depth++) {
+        if ((entry = processes.find(curpid)) == NULL) {
+            // The lazy walk stops at a namespace root; extend it when needed.
+            if (have_snapshot || refreshAncestry(curpid) || ((entry = processes.find(curpid)) == NULL)) {
+                limited_log(0, "%s: Error - ancestor %d is not in UID map.\n", logstr, curpid);
+                return NULL; // If we don't know the UID of an ancestor, something fishy is happening.  Bail.
             }
+        }
+        bool top = (curpid == 1) || (entry->ppid <= 0);
+        if ((entry->uid != 0) && !top && !isNamespaceRoot(entry)) {
+            curpid = entry->ppid;
+            continue;
+        }
+
+        unsigned long long starttime = source_starttime(curpid, source);
+        env_view_t env[ENV_KEY_COUNT];
+        char * env_buf = get_environ(curpid, env);
+        if (!env_buf) {
+            return NULL;
+        }
+        char * result = NULL;
+        if (entry->uid == 0) { // Welcome to your starter!
             char scratch_dir[PATH_MAX];
-            if (snprintf(scratch_dir, PATH_MAX, "%s/dir_%d", execute_dir, *it) >= PATH_MAX) {
-                lcmaps_log(0, "%s: Error - execute path is too long: %s\n", logstr, execute_dir);
-                return NULL;
+            if (!env[ENV_EXECUTE].value) {
+                limited_log(0, "%s: Error - unable to find _CONDOR_EXECUTE from starter %d environment\n", logstr, curpid);
+            } else if (snprintf(scratch_dir, PATH_MAX, "%s/dir_%d", env[ENV_EXECUTE].value, curpid) >= PATH_MAX) {
+                limited_log(0, "%s: Error - execute path is too long: %s\n", logstr, env[ENV_EXECUTE].value);
+            } else {
+                result = strdup(scratch_dir);
             }
-            free(execute_dir);
-            char *my_scratch_dir = (char *)malloc(strlen(scratch_dir)+1);
-            if (!my_scratch_dir) return NULL;
-            strcpy(my_scratch_dir, scratch_dir);
-            return my_scratch_dir;
+        } else if (env[ENV_CHIRP_CONFIG].value) {
+            result = strdup(env[ENV_CHIRP_CONFIG].value);
+        } else if (env[ENV_SCRATCH_DIR].value) {
+            // The chirp config lives in the job's scratch directory.
+            result = strdup(env[ENV_SCRATCH_DIR].value);
+        } else if (top) {
+            limited_log(0, "%s: Error - unable to find _CONDOR_CHIRP_CONFIG from starter %d environment.\n", logstr, curpid);
+        } else {
+            lcmaps_log_debug(2, "%s: Namespace root %d has no chirp config; continuing with its parent %d.\n", logstr, curpid, entry->ppid);
+            free(env_buf);
+            curpid = entry->ppid;
+            continue;
+        }
+        free(env_buf);
+        if (result) {
+            set_source(source, curpid, entry->uid, entry->gid, starttime);
         }
+        return result;
     }
-    lcmaps_log(0, "%s: Error - _CONDOR_EXECUTE missing from ancestors.\n", logstr);
+    limited_log(0, "%s: Error - ancestry of %d exceeds %d processes; possible loop.\n", logstr, pid, MAX_ANCESTRY_DEPTH);
     return NULL;
 }
 
@@ -335,101 +809,473 @@ int CondorAncestry::getParentIDs(pid_t pid, uid_t *uid, gid_t *gid) {
         gid = &internal_gid;
     }
 
-    PidPidMap::const_iterator it;
-    PidIntMap::const_iterator it2;
+    const ProcessEntry *entry;
     pid_t old_ppid, new_ppid;
-    int result, fd;
-    char path[PATH_MAX];
 
-    if ((it = reverse_parentage_mapping.find(pid)) == reverse_parentage_mapping.end()) {
-        lcmaps_log(0, "%s: Error - Unknown PPID of %d", logstr, pid);
+    if ((entry = processes.find(pid)) == NULL) {
+        limited_log(0, "%s: Error - Unknown PPID of %d\n", logstr, pid);
         return -1;
     }
-    old_ppid = it->second;
+    old_ppid = entry->ppid;
 
-    if (snprintf(path, PATH_MAX, "/proc/%d/status", pid) >= PATH_MAX) {
-        lcmaps_log(0, "%s: Error - overly long PID: %d\n", logstr, pid);
+    unsigned long long starttime;
+    if (read_proc_stat(pid, &new_ppid, &starttime)) {
         return -1;
     }
-    if ((fd = open(path, O_RDONLY)) == -1) {
-        lcmaps_log(0, "%s: Error opening process %d status file: %d %s\n", logstr, pid, errno, strerror(errno));
+    if (new_ppid != old_ppid) {
+        limited_log(0, "%s: Error - parent PID changed.  Possible race attack.  Old %d; new %d\n", logstr, old_ppid, new_ppid);
         return -1;
     }
-    if ((result = get_proc_info(fd, (int *)uid, (int *)gid, &new_ppid))) {
-        lcmaps_log(0, "%s: Error - unable to parse status file for PID %d: %d\n", logstr, pid, result);
-        close(fd);
+
+    if ((entry = processes.find(new_ppid)) == NULL) {
+        limited_log(0, "%s: Error - ancestor of %d is not in UID map.\n", logstr, pid);
+        return -1; // If we don't know the UID of an ancestor, something fishy is happening.  Bail.
+    }
+    *uid = entry->uid;
+    *gid = entry->gid;
+
+    return 0;
+
+}
+
+bool CondorAncestry::isStarter(pid_t pid) {
+    const ProcessEntry *entry = processes.find(pid);
+    if (!entry || (entry->uid != 0)) {
+        return false;
+    }
+    env_view_t env[ENV_KEY_COUNT];
+    char *env_buf = get_environ(pid, env);
+    bool result = env_buf && env[ENV_EXECUTE].value;
+    free(env_buf);
+    return result;
+}
+
+int CondorAncestry::children(pid_t pid, PidList &result) const {
+    if (!have_children) {
         return -1;
     }
-    close(fd);
-    if (new_ppid != old_ppid) {
-        lcmaps_log(0, "%s: Error - parent PID changed.  Possible race attack.  Old %d; new %d\n", logstr, old_ppid, new_ppid);
+    ChildIndex::const_iterator it = std::lower_bound(child_index.begin(), child_index.end(), std::make_pair(pid, (pid_t)0));
+    for (; (it != child_index.end()) && (it->first == pid); it++) {
+        result.push_back(it->second);
+    }
+    return 0;
+}
+
+int CondorAncestry::findStarters(std::vector<pid_t> &starters) {
+    if (!have_children) {
         return -1;
     }
+    // The index is sorted by parent, so each candidate is checked once.
+    pid_t last = 0;
+    ChildIndex::const_iterator it;
+    for (it = child_index.begin(); it != child_index.end(); it++) {
+        if ((it->first <= 0) || (it->first == last)) {
+            continue;
+        }
+        const ProcessEntry *parent = processes.find(it->first);
+        const ProcessEntry *child = processes.find(it->second);
+        if (!parent || !child || (parent->uid != 0) || (child->uid == 0)) {
+            continue;
+        }
+        last = it->first;
+        if (isStarter(last)) {
+            starters.push_back(last);
+        }
+    }
+    return 0;
+}
 
-    if ((it2 = process_uid_mapping.find(new_ppid)) == process_uid_mapping.end()) {
-        lcmaps_log(0, "%s: Error - ancestor of %d is not in UID map.\n", logstr, pid);
-        return -1; // If we don't know the UID of an ancestor, something fishy is happening.  Bail.
+// A process waiting to be visited by walkJob.
+struct JobWalkEntry {
+    pid_t pid;
+    int pilot_uid;   // UID of the starter's child this process descends from.
+    bool in_payload; // Below a payload already reported.
+};
+
+// Depth-first walk of the job under starter, in PID order.  Root-owned
+// processes end the walk down their branch; a payload's descendants are job
+// processes but not payloads.
+int CondorAncestry::walkJob(pid_t starter, std::vector<pid_t> *job, std::vector<pid_t> *payloads) const {
+    if (!have_children) {
+        return -1;
+    }
+    std::vector<JobWalkEntry> stack;
+    PidList kids;
+    children(starter, kids);
+    for (size_t idx = kids.size(); idx > 0; idx--) {
+        const ProcessEntry *entry = processes.find(kids[idx-1]);
+        if (entry && (entry->uid != 0)) {
+            JobWalkEntry pilot = {entry->pid, entry->uid, false};
+            stack.push_back(pilot);
+        }
+    }
+    size_t visited = 0;
+    while (!stack.empty()) {
+        JobWalkEntry cur = stack.back();
+        stack.pop_back();
+        const ProcessEntry *entry = processes.find(cur.pid);
+        if (!entry || (entry->uid == 0)) {
+            continue;
+        }
+        // A snapshot is read over time; PID reuse could in principle make a loop.
+        if (++visited > processes.size()) {
+            limited_log(0, "%s: Error - loop in the process tree under starter %d.\n", logstr, starter);
+            return -1;
+        }
+        if (job) {
+            job->push_back(cur.pid);
+        }
+        if (!cur.in_payload && (entry->uid != cur.pilot_uid)) {
+            cur.in_payload = true;
+            if (payloads) {
+                payloads->push_back(cur.pid);
+            }
+        }
+        kids.clear();
+        children(cur.pid, kids);
+        for (size_t idx = kids.size(); idx > 0; idx--) {
+            JobWalkEntry next = {kids[idx-1], cur.pilot_uid, cur.in_payload};
+            stack.push_back(next);
+        }
     }
-    *uid = it2->second;
+    return 0;
+}
 
-    if ((it2 = process_gid_mapping.find(new_ppid)) == process_gid_mapping.end()) {
-        lcmaps_log(0, "%s: Error - ancestor of %d is not in GID map.\n", logstr, pid);
-        return -1; // If we don't know the UID of an ancestor, something fishy is happening.  Bail.
+int CondorAncestry::findJobProcesses(pid_t starter, std::vector<pid_t> &job) const {
+    return walkJob(starter, &job, NULL);
+}
+
+int CondorAncestry::findPayloads(pid_t starter, std::vector<pid_t> &payloads) const {
+    return walkJob(starter, NULL, &payloads);
+}
+
+// HTCondor names the cgroup of a slot's job after the execute directory and
+// the slot: "condor" + EXECUTE with each '/' replaced by '_', then "_" and the
+// slot name, e.g. condor_var_lib_condor_execute_slot1_1@node.
+#define CONDOR_CGROUP_PREFIX "condor_"
+
+// Finds the HTCondor job cgroup of pid (v2, or any v1 hierarchy) and returns
+// its directory under cgroup_root and its last path component.
+static int find_job_cgroup(pid_t pid, char *dir, char *name) {
+    char path[PATH_MAX];
+    char buffer[buf_size];
+    ssize_t bytes;
+    int fd;
+    if (snprintf(path, PATH_MAX, "%s/%d/cgroup", proc_root, pid) >= PATH_MAX) {
+        return -1;
     }
-    *gid = it2->second;
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        return -1;
+    }
+    bytes = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (bytes <= 0) {
+        return -1;
+    }
+    buffer[bytes] = '\0';
 
-    return 0;
+    // Lines are "hierarchy-ID:controller-list:path"; v2 has an empty list.
+    char *next = buffer, *line;
+    while ((line = strsep(&next, "\n"))) {
+        char *controllers, *cgroup, *leaf;
+        if (!strsep(&line, ":") || ((controllers = strsep(&line, ":")) == NULL) || ((cgroup = line) == NULL)) {
+            continue;
+        }
+        leaf = strrchr(cgroup, '/');
+        leaf = leaf ? leaf + 1 : cgroup;
+        if (strncmp(leaf, CONDOR_CGROUP_PREFIX, strlen(CONDOR_CGROUP_PREFIX)) || (strlen(leaf) > NAME_MAX)) {
+            continue;
+        }
+        if (!strncmp(controllers, "name=", 5)) {
+            controllers += 5;
+        }
+        int len = *controllers ? snprintf(dir, PATH_MAX, "%s/%s%s", cgroup_root, controllers, cgroup)
+                               : snprintf(dir, PATH_MAX, "%s%s", cgroup_root, cgroup);
+        if (len >= PATH_MAX) {
+            continue;
+        }
+        strcpy(name, leaf);
+        return 0;
+    }
+    return -1;
+}
 
+static int read_cgroup_procs(const char *dir, std::vector<pid_t> &procs) {
+    char path[PATH_MAX];
+    FILE *fp;
+    int pid;
+    if (snprintf(path, PATH_MAX, "%s/cgroup.procs", dir) >= PATH_MAX) {
+        return -1;
+    }
+    if ((fp = fopen(path, "r")) == NULL) {
+        lcmaps_log_debug(2, "%s: Unable to open %s: %d %s\n", logstr, path, errno, strerror(errno));
+        return -1;
+    }
+    while (fscanf(fp, "%d", &pid) == 1) {
+        procs.push_back(pid);
+    }
+    fclose(fp);
+    std::sort(procs.begin(), procs.end());
+    return 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cout << "Usage: condor_discovery pid" << std::endl;
-        exit(1);
+char * findCondorScratchByCgroup(pid_t pid, ProcessEntry *source) {
+    /* The starter is the parent of the job's top-level process, so it is the
+       first ancestor of pid outside the job's cgroup.  Walking there costs a
+       stat read per process of the job between pid and the top, and nothing
+       for the rest of the node.  The result is only trusted if that process
+       is root-owned and its _CONDOR_EXECUTE matches the cgroup name.
+     */
+    char dir[PATH_MAX], name[NAME_MAX + 1];
+    std::vector<pid_t> procs;
+    if (source) {
+        source->pid = 0;
     }
-    pid_t proc;
-    if (sscanf(argv[1], "%d", &proc) != 1) {
-        std::cout << "Not a valid pid: " << argv[1] << std::endl;
-        exit(1);
+    if (find_job_cgroup(pid, dir, name) || read_cgroup_procs(dir, procs) ||
+        !std::binary_search(procs.begin(), procs.end(), pid)) {
+        lcmaps_log_debug(2, "%s: No HTCondor job cgroup for %d; using the process ancestry.\n", logstr, pid);
+        return NULL;
     }
-    CondorAncestry ca;
-    ca.mineProc();
-    PidList ancestry;
-    int rc;
-    if ((rc = ca.makeAncestry(proc, ancestry))) {
-        lcmaps_log(0, "%s: Error: unable to determine ancestry of %d: %d\n", logstr, proc, rc);
-        return 1;
+
+    pid_t curpid = pid, ppid, starter = -1;
+    unsigned long long starttime;
+    for (unsigned depth = 0; depth < MAX_ANCESTRY_DEPTH; depth++) {
+        if (read_proc_stat(curpid, &ppid, &starttime) || (ppid <= 0)) {
+            return NULL;
+        }
+        if (!std::binary_search(procs.begin(), procs.end(), ppid)) {
+            starter = ppid;
+            break;
+        }
+        curpid = ppid;
+    }
+    ProcessEntry record;
+    if ((starter <= 0) || read_proc_status(starter, &record)) {
+        return NULL;
+    }
+    if (record.uid != 0) {
+        lcmaps_log_debug(2, "%s: Parent %d of cgroup %s is not a root starter (UID %d).\n", logstr, starter, name, record.uid);
+        return NULL;
     }
-    PidList::const_iterator it;
-    std::cout << "Ancestry: ";
-    for (it = ancestry.begin(); it != ancestry.end(); it++) {
-        std::cout << *it << ", ";
+
+    unsigned long long starter_starttime = source_starttime(starter, source);
+    env_view_t env[ENV_KEY_COUNT];
+    char *env_buf = get_environ(starter, env);
+    if (!env_buf) {
+        return NULL;
     }
-    std::cout << std::endl;
-    char * scratch;
-    if (!(scratch = ca.findCondorScratch(proc))) {
-        std::cout << "Unable to find scratch" << std::endl;
+    char *result = NULL;
+    if (!env[ENV_EXECUTE].value) {
+        lcmaps_log_debug(2, "%s: Parent %d of cgroup %s has no _CONDOR_EXECUTE.\n", logstr, starter, name);
     } else {
-        std::cout << "Scratch: " << scratch << std::endl;
-        free(scratch);
+        // The cgroup name must start with the mangled execute directory.
+        size_t exec_len = env[ENV_EXECUTE].len;
+        while ((exec_len > 1) && (env[ENV_EXECUTE].value[exec_len - 1] == '/')) {
+            exec_len--;
+        }
+        size_t idx, prefix_len = strlen("condor");
+        bool match = !strncmp(name, "condor", prefix_len) && (strlen(name) > prefix_len + exec_len) &&
+                     (name[prefix_len + exec_len] == '_');
+        for (idx = 0; match && (idx < exec_len); idx++) {
+            char expected = (env[ENV_EXECUTE].value[idx] == '/') ? '_' : env[ENV_EXECUTE].value[idx];
+            match = (name[prefix_len + idx] == expected);
+        }
+        char scratch_dir[PATH_MAX];
+        if (!match) {
+            lcmaps_log_debug(2, "%s: Cgroup %s does not belong to starter %d.\n", logstr, name, starter);
+        } else if (snprintf(scratch_dir, PATH_MAX, "%.*s/dir_%d", (int)exec_len, env[ENV_EXECUTE].value, starter) < PATH_MAX) {
+            result = strdup(scratch_dir);
+        }
+    }
+    free(env_buf);
+    if (result) {
+        set_source(source, starter, record.uid, record.gid, starter_starttime);
     }
-    uid_t uid; gid_t gid;
-    ca.getParentIDs(proc, &uid, &gid);
-    std::cout << "Invoking UID: " << uid << std::endl;
+    return result;
 }
 
-char * findCondorScratch(pid_t proc) {
+// Walks up from pid reading only stat files (the PPID and start time) until
+// an ancestor is found in the node-wide cache.  Returns its result, or NULL.
+static char * find_cached_scratch(pid_t pid) {
+    char scratch[DISCOVERY_CACHE_PATH_LEN];
+    pid_t curpid = pid, ppid;
+    unsigned long long starttime;
+    uid_t uid;
+    gid_t gid;
+    for (unsigned depth = 0; depth < MAX_ANCESTRY_DEPTH; depth++) {
+        if (read_proc_stat(curpid, &ppid, &starttime)) {
+            return NULL;
+        }
+        if ((curpid != pid) && !discovery_cache_lookup(curpid, starttime, scratch, sizeof(scratch), &uid, &gid)) {
+            lcmaps_log_debug(2, "%s: Found %d, ancestor of %d, in the discovery cache.\n", logstr, curpid, pid);
+            stats_count(STATS_CACHE_HITS, 1);
+            return strdup(scratch);
+        }
+        if ((curpid == 1) || (ppid <= 0)) {
+            return NULL;
+        }
+        curpid = ppid;
+    }
+    return NULL;
+}
+
+static void cache_result(const char *result, const ProcessEntry &source) {
+    if (result && (source.pid > 0)) {
+        discovery_cache_store(source.pid, source.starttime, result, source.uid, source.gid);
+    }
+}
+
+void setCondorScanThreads(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? cpus : 1;
+    }
+    scan_threads = threads;
+}
+
+void setCondorScanUring(int enable) {
+    scan_uring = enable;
+}
+
+int setCondorProcRoot(const char *root) {
+    if (snprintf(proc_root, PATH_MAX, "%s", root) >= PATH_MAX) {
+        limited_log(0, "%s: Error - proc root is too long: %s\n", logstr, root);
+        snprintf(proc_root, PATH_MAX, "/proc");
+        return -1;
+    }
+    return 0;
+}
+
+int setCondorCgroupRoot(const char *root) {
+    if (snprintf(cgroup_root, PATH_MAX, "%s", root) >= PATH_MAX) {
+        limited_log(0, "%s: Error - cgroup root is too long: %s\n", logstr, root);
+        snprintf(cgroup_root, PATH_MAX, "/sys/fs/cgroup");
+        return -1;
+    }
+    return 0;
+}
+
+int setCondorDiscoveryCache(const char *path) {
+    if (!path) {
+        discovery_cache_close();
+        return 0;
+    }
+    return discovery_cache_open(path);
+}
+
+int setCondorDiscoveryDaemon(const char *path) {
+    if (!path) {
+        daemon_socket[0] = '\0';
+        return 0;
+    }
+    if (snprintf(daemon_socket, PATH_MAX, "%s", path) >= PATH_MAX) {
+        limited_log(0, "%s: Error - discovery daemon socket path is too long: %s\n", logstr, path);
+        daemon_socket[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
+void setCondorCgroupDiscovery(int enable) {
+    cgroup_discovery = enable;
+}
+
+void setCondorDiscoveryMode(int mode) {
+    discovery_mode = mode;
+}
+
+// levels: how many ancestors of proc are needed; 0 for all of them.
+static CondorAncestry * getCondorAncestry(pid_t proc, unsigned levels) {
     if (!gCA) {
         gCA = new CondorAncestry;
+    }
+    if (discovery_mode == CONDOR_DISCOVERY_REFRESH) {
+        if (!gCA->refreshAncestry(proc, levels)) {
+            return gCA;
+        }
+        limited_log(0, "%s: Refresh of %d failed; falling back to a full scan of %s.\n", logstr, proc, proc_root);
         gCA->mineProc();
+        return gCA;
+    }
+    if (gCA->haveSnapshot()) {
+        return gCA;
     }
-    return gCA->findCondorScratch(proc);
+    if (discovery_mode == CONDOR_DISCOVERY_LAZY) {
+        if (!gCA->mineAncestry(proc, levels)) {
+            return gCA;
+        }
+        limited_log(0, "%s: Lazy discovery of %d failed; falling back to a full scan of %s.\n", logstr, proc, proc_root);
+    }
+    gCA->mineProc();
+    return gCA;
+}
+
+char * findCondorScratch(pid_t proc) {
+    uint64_t start = stats_now();
+    // Where the result came from, if it is to be cached.
+    ProcessEntry source;
+    ProcessEntry *want_source = discovery_cache_enabled() ? &source : NULL;
+    source.pid = 0;
+    daemon_reply_pid = 0;
+    if (daemon_socket[0]) {
+        int result = discovery_daemon_query(daemon_socket, proc, DAEMON_TIMEOUT_MS, &daemon_reply);
+        stats_record(STATS_DISCOVERY, start);
+        if (!result) {
+            stats_count(STATS_DAEMON_HITS, 1);
+            daemon_reply_pid = proc;
+            return strdup(daemon_reply.scratch);
+        }
+        start = stats_now();
+    }
+    if (want_source) {
+        char *result = find_cached_scratch(proc);
+        stats_record(STATS_DISCOVERY, start);
+        if (result) {
+            return result;
+        }
+        start = stats_now();
+    }
+    if (cgroup_discovery) {
+        char *result = findCondorScratchByCgroup(proc, want_source);
+        stats_record(STATS_DISCOVERY, start);
+        if (result) {
+            cache_result(result, source);
+            return result;
+        }
+        start = stats_now();
+    }
+    CondorAncestry *ca = getCondorAncestry(proc, 0);
+    stats_record(STATS_DISCOVERY, start);
+    start = stats_now();
+    char *result = ca->findCondorScratch(proc, want_source);
+    stats_record(STATS_ENVIRON, start);
+    cache_result(result, source);
+    return result;
 }
 
 int getParentIDs(pid_t proc, uid_t *uid, gid_t *gid) {
-    if (!gCA) {
-        gCA = new CondorAncestry;
-        gCA->mineProc();
+    uint64_t start = stats_now();
+    // The daemon checked the parent when it answered findCondorScratch.
+    if (daemon_reply_pid && (proc == daemon_reply_pid)) {
+        if (uid) {
+            *uid = daemon_reply.parent_uid;
+        }
+        if (gid) {
+            *gid = daemon_reply.parent_gid;
+        }
+        stats_record(STATS_PARENT_IDS, start);
+        return 0;
     }
-    return gCA->getParentIDs(proc, uid, gid);
+    // Only proc and its parent are needed.
+    CondorAncestry *ca = getCondorAncestry(proc, 1);
+    stats_record(STATS_DISCOVERY, start);
+    start = stats_now();
+    int result = ca->getParentIDs(proc, uid, gid);
+    stats_record(STATS_PARENT_IDS, start);
+    return result;
+}
+
+void freeCondorAncestry() {
+    delete gCA;
+    gCA = NULL;
 }
@@ -1,4 +1,3 @@
-
 #ifndef __CONDOR_DISCOVERY_H
 #define __CONDOR_DISCOVERY_H
 
@@ -8,12 +7,192 @@
 extern "C" {
 #endif
 
+/* Discovery modes: walk only the ancestors of the queried process (the
+   default), or snapshot every process in /proc up front. */
+#define CONDOR_DISCOVERY_LAZY 0
+#define CONDOR_DISCOVERY_FULL 1
+/* Lazy, but for a long-lived process: on every query, re-validate each
+   cached ancestor against its start time and re-read only what changed. */
+#define CONDOR_DISCOVERY_REFRESH 2
+
+void setCondorDiscoveryMode(int);
+int setCondorProcRoot(const char *);
+/* Number of threads used by a full scan of /proc; 0 means one per CPU. */
+void setCondorScanThreads(int);
+/* Read the status files of a full scan in batches through io_uring (on by
+   default); without io_uring, the files are read one at a time. */
+void setCondorScanUring(int);
+/* Look for the starter through the job's cgroup before walking the process
+   tree (on by default); the cgroup hierarchies are mounted at root. */
+void setCondorCgroupDiscovery(int);
+int setCondorCgroupRoot(const char *root);
+/* Share discovery results with other invocations on the node through the
+   cache file at path (see discovery_cache.h); NULL stops using it. */
+int setCondorDiscoveryCache(const char *path);
+/* Ask the discovery daemon listening on the socket at path (see
+   discovery_daemon.h) before looking at /proc; if it does not answer,
+   discovery carries on as configured.  NULL stops asking it. */
+int setCondorDiscoveryDaemon(const char *path);
+
 char * findCondorScratch(pid_t);
 int getParentIDs(pid_t, uid_t*, gid_t*);
+/* Release the cached process snapshot. */
+void freeCondorAncestry(void);
 
 #ifdef __cplusplus
 }
-#endif
+
+#include <string.h>
+#include <utility>
+#include <vector>
+
+// A sequence that keeps its first N elements inline and only touches the heap
+// for longer sequences; an ancestry chain is rarely more than a dozen deep.
+template <typename T, size_t N>
+class SmallVector {
+
+public:
+    typedef const T * const_iterator;
+
+    SmallVector() : count(0) {}
+
+    void push_back(const T &value) {
+        if (count < N) {
+            inline_storage[count] = value;
+        } else {
+            if (count == N) {
+                overflow.assign(inline_storage, inline_storage + N);
+            }
+            overflow.push_back(value);
+        }
+        count++;
+    }
+    size_t size() const {return count;}
+    bool empty() const {return count == 0;}
+    void clear() {count = 0; overflow.clear();}
+    const T * data() const {return (count <= N) ? inline_storage : &overflow[0];}
+    const T & operator[](size_t idx) const {return data()[idx];}
+    const_iterator begin() const {return data();}
+    const_iterator end() const {return data() + count;}
+    bool operator==(const SmallVector &other) const {
+        if (count != other.count) return false;
+        for (size_t idx = 0; idx < count; idx++) {
+            if ((*this)[idx] != other[idx]) return false;
+        }
+        return true;
+    }
+    bool operator!=(const SmallVector &other) const {return !(*this == other);}
+
+private:
+    T inline_storage[N];
+    std::vector<T> overflow;
+    size_t count;
+};
+
+typedef SmallVector<pid_t, 16> PidList;
+
+// Everything discovery records about one process.
+struct ProcessEntry {
+    pid_t pid;  // 0 marks an unused slot.
+    pid_t ppid;
+    int uid;
+    int gid;
+    unsigned long long starttime; // From /proc/<pid>/stat; 0 if not read.
+    pid_t ns_pid;  // PID inside the process's own PID namespace; -1 if unknown.
+    int ns_depth;  // PID namespaces between that of the proc root and the process's.
+};
+
+// Process table keyed by PID: one record per process in a single flat array,
+// so a lookup touches one cache line.  Uses open addressing with linear
+// probing, or indexes directly by PID when the node's pid_max is small
+// compared to the number of processes.
+class ProcessTable {
+
+public:
+    ProcessTable();
+
+    const ProcessEntry * find(pid_t) const;
+    ProcessEntry * insert(pid_t); // Returns the existing entry for pid, if any.
+    void erase(pid_t);
+    void reserve(size_t expected, pid_t pid_max); // pid_max of 0 means unknown.
+    size_t size() const {return count;}
+    void clear();
+    void pids(std::vector<pid_t> &) const; // Appends every PID in the table.
+
+private:
+    size_t slot(pid_t) const;
+    void rehash(size_t capacity, bool dense);
+
+    std::vector<ProcessEntry> slots;
+    size_t count;
+    bool dense;
+};
+
+// Scratch directory of the starter whose job cgroup contains pid, or NULL if
+// pid is not in an HTCondor job cgroup.  Caller frees the result.  If source
+// is given, it is filled in with the starter (pid 0 if it could not be
+// confirmed), for the discovery cache.
+char * findCondorScratchByCgroup(pid_t pid, ProcessEntry *source = NULL);
+
+class CondorAncestry {
+
+public:
+    CondorAncestry() : have_snapshot(false), have_children(false) {}
+
+    // Note: Caller takes ownership of returned pointer on heap.  source is as
+    // for findCondorScratchByCgroup: the starter or container init used.
+    char * findCondorScratch(pid_t, ProcessEntry *source = NULL);
+    int makeAncestry(pid_t, PidList&);
+    int mineProc();
+    // max_levels limits the walk to that many ancestors; 0 walks up to init.
+    int mineAncestry(pid_t, unsigned max_levels = 0);
+    int refreshAncestry(pid_t, unsigned max_levels = 0);
+    // One step of refreshAncestry: re-read pid's stat file, and its status
+    // file unless the start time matches.  Returns the entry, or NULL.
+    const ProcessEntry * refreshProcess(pid_t);
+    int getParentIDs(pid_t, uid_t*, gid_t*);
+    // A root-owned process with _CONDOR_EXECUTE in its environment.
+    bool isStarter(pid_t);
+
+    // The queries below walk down the process tree, so they need the
+    // parent->children index that mineProc builds; they fail without it.
+    int children(pid_t, PidList&) const;
+    // Every starter on the node.  Only root-owned processes with a non-root
+    // child are candidates, so few environments are read.
+    int findStarters(std::vector<pid_t>&);
+    // The processes of the starter's job: its non-root descendants, not
+    // counting those below another root-owned process.
+    int findJobProcesses(pid_t starter, std::vector<pid_t>&) const;
+    // The glexec'd payloads under the starter: the topmost job processes
+    // running as neither root nor the pilot (the starter's child).  Costs
+    // the size of the starter's subtree, not of the node.
+    int findPayloads(pid_t starter, std::vector<pid_t>&) const;
+
+    // Changes reported by process events, for the discovery daemon.  A child
+    // starts as a copy of its parent, as the kernel copies the credentials,
+    // with the start time (and PID namespace) unknown; it is not recorded if
+    // the parent is not known either.  An ID of -1 is left unchanged.
+    void addChild(pid_t parent, pid_t child);
+    void removeProcess(pid_t);
+    void setIDs(pid_t, int uid, int gid);
+
+    bool haveSnapshot() const {return have_snapshot;}
+    const ProcessEntry * find(pid_t pid) const {return processes.find(pid);}
+    size_t size() const {return processes.size();}
+    void pids(std::vector<pid_t> &result) const {processes.pids(result);}
+
+private:
+    typedef std::vector<std::pair<pid_t, pid_t> > ChildIndex;
+
+    int walkJob(pid_t starter, std::vector<pid_t> *job, std::vector<pid_t> *payloads) const;
+
+    ProcessTable processes;
+    bool have_snapshot;
+    // (PPID, PID) of every process in the snapshot, sorted.
+    ChildIndex child_index;
+    bool have_children;
+};
 
 #endif
 
+#endif
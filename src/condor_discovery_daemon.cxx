@@ -0,0 +1,86 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+extern "C" {
+#include "lcmaps/lcmaps_log.h"
+}
+
+#include "condor_discovery.h"
+#include "discovery_daemon.h"
+
+static const char * logstr = "condor_discovery_daemon";
+
+static volatile sig_atomic_t stopping = 0;
+
+static void usage() {
+    std::cout << "Usage: condor_discovery_daemon [--proc-root dir] [--threads N] [--replay file|-] --socket path" << std::endl
+              << "Runs in the foreground until SIGTERM or SIGINT.  With --replay, process events are read" << std::endl
+              << "from the file (one per line: fork P C, exec P, exit P, uid P U, gid P G) instead of the" << std::endl
+              << "kernel's proc connector." << std::endl;
+    exit(1);
+}
+
+static void handle_stop(int) {
+    stopping = 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = NULL, *replay = NULL;
+    int argidx = 1;
+    while (argidx < argc) {
+        if ((strncmp(argv[argidx], "--", 2) != 0) || (argidx + 1 >= argc)) {
+            usage();
+        } else if (strcmp(argv[argidx], "--socket") == 0) {
+            socket_path = argv[argidx+1];
+        } else if (strcmp(argv[argidx], "--replay") == 0) {
+            replay = argv[argidx+1];
+        } else if (strcmp(argv[argidx], "--proc-root") == 0) {
+            if (setCondorProcRoot(argv[argidx+1])) {
+                exit(1);
+            }
+        } else if (strcmp(argv[argidx], "--threads") == 0) {
+            setCondorScanThreads(atoi(argv[argidx+1]));
+        } else {
+            usage();
+        }
+        argidx += 2;
+    }
+    if (!socket_path) {
+        usage();
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    DiscoveryDaemon daemon;
+    // Events first, so that nothing started during the scan is missed.
+    if (replay) {
+        int fd = strcmp(replay, "-") ? open(replay, O_RDONLY | O_CLOEXEC) : dup(0);
+        if (fd == -1) {
+            lcmaps_log(0, "%s: Unable to open %s.\n", logstr, replay);
+            return 1;
+        }
+        daemon.setReplay(fd);
+    } else if (daemon.openConnector()) {
+        return 1;
+    }
+    if (daemon.scan() || daemon.listen(socket_path)) {
+        return 1;
+    }
+    lcmaps_log(0, "%s: Tracking %lu processes; listening at %s.\n", logstr, (unsigned long)daemon.size(), socket_path);
+    while (!stopping) {
+        if (daemon.poll(-1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
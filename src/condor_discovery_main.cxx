@@ -0,0 +1,245 @@
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "lcmaps/lcmaps_log.h"
+}
+
+#include "condor_discovery.h"
+
+static const char * logstr = "condor_discovery";
+
+static void usage() {
+    std::cout << "Usage: condor_discovery [--proc-root dir] [--cgroup-root dir] [--threads N] pid" << std::endl
+              << "       condor_discovery [options] --json pid [pid ...]" << std::endl
+              << "       condor_discovery [options] --json --all-payloads" << std::endl
+              << "       condor_discovery [options] [--json] --tree" << std::endl;
+    exit(1);
+}
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static std::string json_string(const char *value) {
+    if (!value) {
+        return "null";
+    }
+    std::string result = "\"";
+    for (; *value; value++) {
+        unsigned char c = *value;
+        if ((c == '"') || (c == '\\')) {
+            result += '\\';
+            result += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+// One JSON object per line: the ancestry of pid, the scratch directory (or
+// chirp config) and the process it came from, the IDs of pid and of its
+// parent, and how long the lookup took against the shared snapshot.
+static void print_json(CondorAncestry &ca, pid_t pid) {
+    PidList ancestry;
+    ProcessEntry source;
+    const ProcessEntry *entry;
+    uid_t parent_uid;
+    gid_t parent_gid;
+    double start = now_us();
+    int ancestry_rc = ca.makeAncestry(pid, ancestry);
+    char *scratch = ancestry_rc ? NULL : ca.findCondorScratch(pid, &source);
+    int parent_rc = ca.getParentIDs(pid, &parent_uid, &parent_gid);
+    double elapsed = now_us() - start;
+
+    std::cout << "{\"pid\":" << pid << ",\"ancestry\":[";
+    for (size_t idx = 0; idx < ancestry.size(); idx++) {
+        std::cout << (idx ? "," : "") << ancestry[idx];
+    }
+    std::cout << "],\"scratch\":" << json_string(scratch) << ",\"source\":";
+    if (scratch && (source.pid > 0)) {
+        std::cout << source.pid;
+    } else {
+        std::cout << "null";
+    }
+    if ((entry = ca.find(pid))) {
+        std::cout << ",\"uid\":" << entry->uid << ",\"gid\":" << entry->gid;
+    }
+    if (!parent_rc) {
+        std::cout << ",\"parent_uid\":" << parent_uid << ",\"parent_gid\":" << parent_gid;
+    }
+    std::cout << ",\"lookup_us\":" << elapsed << "}" << std::endl;
+    free(scratch);
+}
+
+// Every process of every job on the node.
+static void find_job_processes(CondorAncestry &ca, std::vector<pid_t> &job) {
+    std::vector<pid_t> starters;
+    ca.findStarters(starters);
+    for (size_t idx = 0; idx < starters.size(); idx++) {
+        ca.findJobProcesses(starters[idx], job);
+    }
+}
+
+static void print_tree(CondorAncestry &ca, pid_t pid, unsigned depth, const std::set<pid_t> &payloads) {
+    const ProcessEntry *entry = ca.find(pid);
+    if (!entry || (entry->uid == 0) || (depth > 1024)) {
+        return;
+    }
+    std::cout << std::string(2 * depth, ' ') << pid << " uid " << entry->uid << " gid " << entry->gid
+              << (payloads.count(pid) ? " [payload]" : "") << std::endl;
+    PidList kids;
+    ca.children(pid, kids);
+    for (size_t idx = 0; idx < kids.size(); idx++) {
+        print_tree(ca, kids[idx], depth + 1, payloads);
+    }
+}
+
+// One entry per slot: the starter, the size of its job, and its glexec'd
+// payloads with their users; either as JSON lines or as indented trees.
+static void print_slots(CondorAncestry &ca, bool json) {
+    std::vector<pid_t> starters;
+    ca.findStarters(starters);
+    for (size_t idx = 0; idx < starters.size(); idx++) {
+        std::vector<pid_t> job, payloads;
+        std::set<int> users;
+        ca.findJobProcesses(starters[idx], job);
+        ca.findPayloads(starters[idx], payloads);
+        for (size_t pidx = 0; pidx < payloads.size(); pidx++) {
+            users.insert(ca.find(payloads[pidx])->uid);
+        }
+        if (json) {
+            std::cout << "{\"starter\":" << starters[idx] << ",\"processes\":" << job.size() << ",\"payloads\":[";
+            for (size_t pidx = 0; pidx < payloads.size(); pidx++) {
+                std::cout << (pidx ? "," : "") << payloads[pidx];
+            }
+            std::cout << "],\"users\":[";
+            for (std::set<int>::const_iterator it = users.begin(); it != users.end(); it++) {
+                std::cout << (it == users.begin() ? "" : ",") << *it;
+            }
+            std::cout << "]}" << std::endl;
+            continue;
+        }
+        std::cout << "Starter " << starters[idx] << ": " << job.size() << " job processes, "
+                  << payloads.size() << " payloads, " << users.size() << " users" << std::endl;
+        std::set<pid_t> payload_set(payloads.begin(), payloads.end());
+        PidList kids;
+        ca.children(starters[idx], kids);
+        for (size_t kidx = 0; kidx < kids.size(); kidx++) {
+            print_tree(ca, kids[kidx], 1, payload_set);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false, all_payloads = false, tree = false;
+    int argidx = 1;
+    while ((argidx < argc) && (strncmp(argv[argidx], "--", 2) == 0)) {
+        if (strcmp(argv[argidx], "--json") == 0) {
+            json = true;
+            argidx++;
+            continue;
+        } else if (strcmp(argv[argidx], "--all-payloads") == 0) {
+            all_payloads = true;
+            argidx++;
+            continue;
+        } else if (strcmp(argv[argidx], "--tree") == 0) {
+            tree = true;
+            argidx++;
+            continue;
+        } else if (argidx + 1 >= argc) {
+            usage();
+        } else if (strcmp(argv[argidx], "--proc-root") == 0) {
+            if (setCondorProcRoot(argv[argidx+1])) {
+                exit(1);
+            }
+        } else if (strcmp(argv[argidx], "--cgroup-root") == 0) {
+            if (setCondorCgroupRoot(argv[argidx+1])) {
+                exit(1);
+            }
+        } else if (strcmp(argv[argidx], "--threads") == 0) {
+            setCondorScanThreads(atoi(argv[argidx+1]));
+        } else {
+            usage();
+        }
+        argidx += 2;
+    }
+    std::vector<pid_t> pids;
+    for (; argidx < argc; argidx++) {
+        pid_t proc;
+        if (sscanf(argv[argidx], "%d", &proc) != 1) {
+            std::cout << "Not a valid pid: " << argv[argidx] << std::endl;
+            exit(1);
+        }
+        pids.push_back(proc);
+    }
+    if (tree ? (all_payloads || !pids.empty()) :
+        all_payloads ? (!json || !pids.empty()) : (pids.empty() || (!json && (pids.size() != 1)))) {
+        usage();
+    }
+
+    CondorAncestry ca;
+    double start = now_us();
+    ca.mineProc();
+    double snapshot_us = now_us() - start;
+
+    if (tree) {
+        print_slots(ca, json);
+        return 0;
+    }
+    if (json) {
+        if (all_payloads) {
+            find_job_processes(ca, pids);
+        }
+        for (size_t idx = 0; idx < pids.size(); idx++) {
+            print_json(ca, pids[idx]);
+        }
+        fprintf(stderr, "%s: %lu lookups against a snapshot of %lu processes taken in %.0f us\n", logstr,
+                (unsigned long)pids.size(), (unsigned long)ca.size(), snapshot_us);
+        return 0;
+    }
+
+    pid_t proc = pids[0];
+    PidList ancestry;
+    int rc;
+    if ((rc = ca.makeAncestry(proc, ancestry))) {
+        lcmaps_log(0, "%s: Error: unable to determine ancestry of %d: %d\n", logstr, proc, rc);
+        return 1;
+    }
+    PidList::const_iterator it;
+    std::cout << "Ancestry: ";
+    for (it = ancestry.begin(); it != ancestry.end(); it++) {
+        std::cout << *it << ", ";
+    }
+    std::cout << std::endl;
+    char * scratch;
+    if (!(scratch = ca.findCondorScratch(proc))) {
+        std::cout << "Unable to find scratch" << std::endl;
+    } else {
+        std::cout << "Scratch: " << scratch << std::endl;
+        free(scratch);
+    }
+    if (!(scratch = findCondorScratchByCgroup(proc))) {
+        std::cout << "Scratch (cgroup): not in an HTCondor job cgroup" << std::endl;
+    } else {
+        std::cout << "Scratch (cgroup): " << scratch << std::endl;
+        free(scratch);
+    }
+    uid_t uid; gid_t gid;
+    ca.getParentIDs(proc, &uid, &gid);
+    std::cout << "Invoking UID: " << uid << std::endl;
+}
@@ -0,0 +1,88 @@
+
+/*
+ * lcmaps-condor-update
+ * Spawned by the plugin (with -spawn helper) in place of forking glexec:
+ *   condor_update_helper [-e | -d name] [-s [-t attr -i seconds]] [-h attr] status-fd uid gid scratch attr val [attr val ...]
+ * Runs as root, drops to uid/gid and performs the update exactly as the
+ * plugin's forked child would, reporting early errors on status-fd.
+ *   -e  always exec condor_chirp rather than using the native Chirp client
+ *   -d  drop the updates into the file name in the scratch directory
+ *       rather than sending them to the starter
+ *   -s  skip attributes the starter already has; attr is sent at most
+ *       every seconds
+ *   -h  count the invocation in the job's history, by the value of attr,
+ *       and send the totals
+ * This code is under the public domain
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "starter_update.h"
+
+#define MAX_UPDATES 16
+
+static long parse_number(const char *str) {
+  char *end;
+  long value = strtol(str, &end, 10);
+  if ((*str == '\0') || (*end != '\0') || (value < 0)) {
+    return -1;
+  }
+  return value;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-e | -d name] [-s [-t attr -i seconds]] [-h attr] status-fd uid gid scratch attr val [attr val ...]\n", name);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  classad_update_t updates[MAX_UPDATES];
+  update_options_t options = {UPDATE_BACKEND_NATIVE_CHIRP, 0, NULL, 0, NULL, NULL};
+  size_t count = 0;
+  long fd, uid, gid;
+  int opt, idx, nargs;
+
+  while ((opt = getopt(argc, argv, "ed:st:i:h:")) != -1) {
+    switch (opt) {
+    case 'e': options.backend = UPDATE_BACKEND_EXEC_CHIRP; break;
+    case 'd':
+      options.backend = UPDATE_BACKEND_FILE_DROP;
+      options.drop_name = optarg;
+      break;
+    case 's': options.suppress = 1; break;
+    case 't': options.throttle_attr = optarg; break;
+    case 'h': options.history_attr = optarg; break;
+    case 'i':
+      if ((options.throttle_interval = parse_number(optarg)) == -1) usage(argv[0]);
+      break;
+    default: usage(argv[0]);
+    }
+  }
+  nargs = argc - optind;
+  if ((nargs < 6) || ((nargs - 4) % 2) || ((nargs - 4) / 2 > MAX_UPDATES)) {
+    usage(argv[0]);
+  }
+  argv += optind;
+  if (((fd = parse_number(argv[0])) == -1) || ((uid = parse_number(argv[1])) == -1) || ((gid = parse_number(argv[2])) == -1)) {
+    fprintf(stderr, "Invalid status fd, UID or GID\n");
+    return 1;
+  }
+  for (idx = 4; idx + 1 < nargs; idx += 2) {
+    updates[count].attr = argv[idx];
+    updates[count++].val = argv[idx + 1];
+  }
+
+  // As in the plugin, condor_chirp must not inherit the status pipe.
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+    perror("Unable to set close-on-exec on the status pipe");
+    return 1;
+  }
+
+  update_starter_child(updates, count, fd, argv[3], uid, gid, &options);
+  // Does not return.  Just in case:
+  return 1;
+}
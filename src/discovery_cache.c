@@ -0,0 +1,171 @@
+
+/*
+ * lcmaps-condor-update
+ * Node-wide discovery cache; see discovery_cache.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lcmaps/lcmaps_log.h"
+
+#include "discovery_cache.h"
+#include "log_limit.h"
+
+static const char * logstr = "lcmaps-condor-update";
+
+// Bump the last byte when the layout changes; a file with another layout is
+// left alone rather than reinterpreted.
+#define CACHE_MAGIC 0x4c434301U
+#define CACHE_SLOTS 256
+#define CACHE_SLOT_BITS 8
+// A reader gives up (and treats the lookup as a miss) after this many
+// attempts that raced with a writer.
+#define CACHE_READ_TRIES 4
+
+typedef struct {
+  volatile uint32_t seq; // Odd while a writer is updating the slot.
+  int32_t pid;           // 0 for an empty slot.
+  uint64_t starttime;
+  uint32_t uid;
+  uint32_t gid;
+  char scratch[DISCOVERY_CACHE_PATH_LEN];
+} cache_slot_t;
+
+typedef struct {
+  volatile uint32_t magic;
+  uint32_t reserved;
+  cache_slot_t slots[CACHE_SLOTS];
+} cache_file_t;
+
+static cache_file_t *cache = NULL;
+
+static cache_slot_t * cache_slot(pid_t pid) {
+  return &cache->slots[((uint32_t)pid * 2654435769U) >> (32 - CACHE_SLOT_BITS)];
+}
+
+void * cache_file_map(const char *path, size_t size, uint32_t magic, const char *what) {
+  struct stat st;
+  void *addr;
+  int fd;
+
+  if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1) {
+    limited_log(0, "%s: Unable to open %s %s: %d %s\n", logstr, what, path, errno, strerror(errno));
+    return NULL;
+  }
+  if (fstat(fd, &st) == -1) {
+    limited_log(0, "%s: Unable to stat %s %s: %d %s\n", logstr, what, path, errno, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  if (!S_ISREG(st.st_mode) || (st.st_uid != geteuid()) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    limited_log(0, "%s: Refusing %s %s: not a private file owned by UID %d.\n", logstr, what, path, geteuid());
+    close(fd);
+    return NULL;
+  }
+  // Every invocation that finds the file short extends it to the same size;
+  // the new space reads as empty slots.
+  if ((st.st_size < (off_t)size) && (ftruncate(fd, size) == -1)) {
+    limited_log(0, "%s: Unable to size %s %s: %d %s\n", logstr, what, path, errno, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    limited_log(0, "%s: Unable to map %s %s: %d %s\n", logstr, what, path, errno, strerror(errno));
+    return NULL;
+  }
+  // The magic number is the first word of every cache file.
+  __sync_bool_compare_and_swap((volatile uint32_t *)addr, 0, magic);
+  if (*(volatile uint32_t *)addr != magic) {
+    limited_log(0, "%s: The %s %s has an unknown format; not using it.\n", logstr, what, path);
+    munmap(addr, size);
+    return NULL;
+  }
+  return addr;
+}
+
+int discovery_cache_open(const char *path) {
+  discovery_cache_close();
+  cache = (cache_file_t *)cache_file_map(path, sizeof(cache_file_t), CACHE_MAGIC, "discovery cache");
+  return cache ? 0 : -1;
+}
+
+void discovery_cache_close(void) {
+  if (cache) {
+    munmap(cache, sizeof(cache_file_t));
+    cache = NULL;
+  }
+}
+
+int discovery_cache_enabled(void) {
+  return cache != NULL;
+}
+
+int discovery_cache_lookup(pid_t pid, unsigned long long starttime, char *scratch, size_t len, uid_t *uid, gid_t *gid) {
+  cache_slot_t *slot, copy;
+  uint32_t seq;
+  int tries;
+
+  if (!cache || (pid <= 0)) {
+    return -1;
+  }
+  slot = cache_slot(pid);
+  for (tries = 0; tries < CACHE_READ_TRIES; tries++) {
+    seq = slot->seq;
+    __sync_synchronize();
+    if (seq & 1) {
+      continue;
+    }
+    memcpy(&copy, slot, sizeof(copy));
+    __sync_synchronize();
+    if (slot->seq != seq) {
+      continue;
+    }
+    if ((copy.pid != pid) || (copy.starttime != starttime) ||
+        (memchr(copy.scratch, '\0', sizeof(copy.scratch)) == NULL) || (strlen(copy.scratch) >= len)) {
+      return -1;
+    }
+    strcpy(scratch, copy.scratch);
+    *uid = copy.uid;
+    *gid = copy.gid;
+    return 0;
+  }
+  return -1;
+}
+
+void discovery_cache_store(pid_t pid, unsigned long long starttime, const char *scratch, uid_t uid, gid_t gid) {
+  cache_slot_t *slot;
+  uint32_t seq;
+
+  if (!cache || (pid <= 0) || (strlen(scratch) >= DISCOVERY_CACHE_PATH_LEN)) {
+    return;
+  }
+  slot = cache_slot(pid);
+  seq = slot->seq;
+  // The compare-and-swap is both the writers' lock and a full barrier.  A
+  // writer killed in the few instructions below leaves the slot odd, and so
+  // unused, until the file is removed.
+  if ((seq & 1) || !__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1)) {
+    return;
+  }
+  slot->pid = pid;
+  slot->starttime = starttime;
+  slot->uid = uid;
+  slot->gid = gid;
+  memset(slot->scratch, 0, sizeof(slot->scratch));
+  strcpy(slot->scratch, scratch);
+  __sync_synchronize();
+  slot->seq = seq + 2;
+}
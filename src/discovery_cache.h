@@ -0,0 +1,51 @@
+#ifndef __DISCOVERY_CACHE_H
+#define __DISCOVERY_CACHE_H
+
+/*
+ * Node-wide cache of discovery results, shared by every glexec invocation
+ * through a small memory-mapped file (under /dev/shm or /run).  Entries are
+ * keyed by the PID and start time of the process the result came from (the
+ * starter, or a container's init), so a caller that has just read the start
+ * time from /proc cannot be handed the result for an earlier process that
+ * had the same PID.  Slots are read under a sequence lock: readers never
+ * block, and a writer that finds a slot busy simply does not cache.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Results with a longer path are not cached.
+#define DISCOVERY_CACHE_PATH_LEN 512
+
+/* Map the cache file at path, creating it if needed.  The file must be a
+   regular file owned by the effective user and writable by nobody else;
+   anything else is refused, since the cache decides where updates go.
+   Returns 0 on success; on failure the cache is simply not used. */
+int discovery_cache_open(const char *path);
+
+/* The checks and mapping behind discovery_cache_open, for other node-wide
+   caches: map the file at path, size bytes, whose first word is magic (set
+   if the file is new).  what names the cache in log messages.  Returns NULL
+   on failure. */
+void * cache_file_map(const char *path, size_t size, uint32_t magic, const char *what);
+
+void discovery_cache_close(void);
+
+int discovery_cache_enabled(void);
+
+/* Look up the process pid started at starttime.  Returns 0 and fills in the
+   scratch directory (or chirp config) and the process's UID/GID on a hit. */
+int discovery_cache_lookup(pid_t pid, unsigned long long starttime, char *scratch, size_t len, uid_t *uid, gid_t *gid);
+
+void discovery_cache_store(pid_t pid, unsigned long long starttime, const char *scratch, uid_t uid, gid_t gid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
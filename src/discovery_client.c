@@ -0,0 +1,94 @@
+/*
+ * lcmaps-condor-update
+ * Client side of the discovery daemon; see discovery_client.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "lcmaps/lcmaps_log.h"
+
+#include "discovery_client.h"
+#include "log_limit.h"
+
+static const char * logstr = "lcmaps-condor-update";
+
+static int exchange(int fd, const struct sockaddr_un *addr, pid_t pid, discovery_reply_t *reply) {
+  discovery_request_t request;
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  ssize_t bytes;
+
+  if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1) {
+    // Not running is an expected configuration; say so only in debug.
+    lcmaps_log_debug(2, "%s: Discovery daemon at %s is not available: %d %s\n", logstr, addr->sun_path, errno, strerror(errno));
+    return -1;
+  }
+  // The answer decides which UID the update runs as and where it writes;
+  // as with the cache files, only root or our own user may give it.
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+    limited_log(0, "%s: Unable to identify the discovery daemon at %s: %d %s\n", logstr, addr->sun_path, errno, strerror(errno));
+    return -1;
+  }
+  if ((cred.uid != 0) && (cred.uid != geteuid())) {
+    limited_log(0, "%s: Refusing the discovery daemon at %s: it runs as UID %d, not root or UID %d.\n", logstr, addr->sun_path, (int)cred.uid, geteuid());
+    return -1;
+  }
+  request.magic = DISCOVERY_DAEMON_MAGIC;
+  request.pid = pid;
+  if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)) {
+    limited_log(0, "%s: Unable to query the discovery daemon at %s: %d %s\n", logstr, addr->sun_path, errno, strerror(errno));
+    return -1;
+  }
+  if ((bytes = recv(fd, reply, sizeof(*reply), 0)) != sizeof(*reply)) {
+    if (bytes < 0) {
+      limited_log(0, "%s: No answer from the discovery daemon at %s: %d %s\n", logstr, addr->sun_path, errno, strerror(errno));
+    } else {
+      limited_log(0, "%s: Short answer from the discovery daemon at %s\n", logstr, addr->sun_path);
+    }
+    return -1;
+  }
+  if ((reply->magic != DISCOVERY_DAEMON_MAGIC) || !memchr(reply->scratch, '\0', sizeof(reply->scratch))) {
+    limited_log(0, "%s: Malformed answer from the discovery daemon at %s\n", logstr, addr->sun_path);
+    return -1;
+  }
+  if (reply->status) {
+    lcmaps_log_debug(2, "%s: Discovery daemon has no answer for %d: %s\n", logstr, pid, strerror(reply->status));
+    return -1;
+  }
+  return 0;
+}
+
+int discovery_daemon_query(const char *path, pid_t pid, int timeout_ms, discovery_reply_t *reply) {
+  struct sockaddr_un addr;
+  struct timeval timeout;
+  int fd, result;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >= (int)sizeof(addr.sun_path)) {
+    limited_log(0, "%s: Discovery daemon socket path is too long: %s\n", logstr, path);
+    return -1;
+  }
+  if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+    limited_log(0, "%s: Unable to create discovery daemon socket: %d %s\n", logstr, errno, strerror(errno));
+    return -1;
+  }
+  // Connecting blocks, up to the send timeout, when the listen backlog is full.
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  result = exchange(fd, &addr, pid, reply);
+  close(fd);
+  return result;
+}
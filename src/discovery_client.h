@@ -0,0 +1,46 @@
+#ifndef __DISCOVERY_CLIENT_H
+#define __DISCOVERY_CLIENT_H
+
+/*
+ * Protocol of the discovery daemon (condor_discovery_daemon), which keeps the
+ * node's process tree up to date from process events so that glexec does
+ * not have to walk /proc.  A client connects to its SOCK_SEQPACKET Unix
+ * socket, sends one request and reads one reply; both are fixed-size
+ * records in host byte order.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bump the last byte when the layout changes.
+#define DISCOVERY_DAEMON_MAGIC 0x4c434401U
+
+typedef struct {
+  uint32_t magic;
+  int32_t pid;         // The glexec invocation.
+} discovery_request_t;
+
+typedef struct {
+  uint32_t magic;
+  int32_t status;      // 0, or an errno value when the daemon has no answer.
+  int32_t ppid;
+  uint32_t parent_uid; // As getParentIDs.
+  uint32_t parent_gid;
+  char scratch[PATH_MAX]; // As findCondorScratch.
+} discovery_reply_t;
+
+/* Ask the daemon listening at path about pid, waiting at most timeout_ms
+   for each step.  Returns 0 and fills in reply if the daemon answered with a
+   result; -1 if it is not running, did not answer in time, or has none. */
+int discovery_daemon_query(const char *path, pid_t pid, int timeout_ms, discovery_reply_t *reply);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
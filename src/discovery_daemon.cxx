@@ -0,0 +1,401 @@
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "lcmaps/lcmaps_log.h"
+}
+
+#include "discovery_daemon.h"
+#include "log_limit.h"
+
+static const char * logstr = "condor_discovery_daemon";
+
+// Queries being served at once; further clients wait in the listen backlog.
+#define MAX_CLIENTS 64
+// A client that has not sent its request by then is dropped.
+#define CLIENT_TIMEOUT_MS 1000
+// Upper bound on an ancestry chain, as in condor_discovery.cxx.
+#define MAX_DEPTH 1024
+// Socket buffer for proc connector events; a fork storm that overruns it
+// costs a full rescan.
+#define CONNECTOR_RCVBUF (8 * 1024 * 1024)
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+DiscoveryDaemon::DiscoveryDaemon() : sequence(0), event_fd(-1), replay(false), listen_fd(-1) {}
+
+DiscoveryDaemon::~DiscoveryDaemon() {
+    for (size_t idx = 0; idx < clients.size(); idx++) {
+        close(clients[idx].fd);
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+    if (event_fd != -1) {
+        close(event_fd);
+    }
+}
+
+int DiscoveryDaemon::openConnector() {
+    struct sockaddr_nl addr;
+    int bufsize = CONNECTOR_RCVBUF;
+    int fd;
+
+    if ((fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR)) == -1) {
+        limited_log(0, "%s: Unable to open the proc connector: %d %s\n", logstr, errno, strerror(errno));
+        return -1;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufsize, sizeof(bufsize)) == -1) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        limited_log(0, "%s: Unable to bind to the proc connector: %d %s\n", logstr, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // A netlink header, then a connector message carrying the operation.
+    char request[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *header = (struct nlmsghdr *)request;
+    struct cn_msg *msg = (struct cn_msg *)NLMSG_DATA(header);
+    enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+    memset(request, 0, sizeof(request));
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    header->nlmsg_type = NLMSG_DONE;
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = sizeof(op);
+    memcpy(msg->data, &op, sizeof(op));
+    if (send(fd, request, header->nlmsg_len, 0) != (ssize_t)header->nlmsg_len) {
+        limited_log(0, "%s: Unable to subscribe to process events: %d %s\n", logstr, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    event_fd = fd;
+    replay = false;
+    return 0;
+}
+
+void DiscoveryDaemon::setReplay(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    event_fd = fd;
+    replay = true;
+}
+
+int DiscoveryDaemon::scan() {
+    born.clear();
+    int result = ca.mineProc();
+    lcmaps_log_debug(2, "%s: Scanned %lu processes.\n", logstr, (unsigned long)ca.size());
+    return result;
+}
+
+int DiscoveryDaemon::listen(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >= (int)sizeof(addr.sun_path)) {
+        limited_log(0, "%s: Socket path is too long: %s\n", logstr, path);
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        limited_log(0, "%s: Unable to create socket: %d %s\n", logstr, errno, strerror(errno));
+        return -1;
+    }
+    // Left behind by a daemon that did not exit cleanly.
+    unlink(path);
+    if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+        (chmod(path, 0600) == -1) ||
+        (::listen(fd, MAX_CLIENTS) == -1)) {
+        limited_log(0, "%s: Unable to listen at %s: %d %s\n", logstr, path, errno, strerror(errno));
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    listen_fd = fd;
+    socket_path = path;
+    return 0;
+}
+
+void DiscoveryDaemon::forked(pid_t parent, pid_t child) {
+    ca.addChild(parent, child);
+    born[child] = ++sequence;
+}
+
+void DiscoveryDaemon::exited(pid_t pid) {
+    ca.removeProcess(pid);
+    born.erase(pid);
+}
+
+unsigned long DiscoveryDaemon::bornAt(pid_t pid) const {
+    std::map<pid_t, unsigned long>::const_iterator it = born.find(pid);
+    return (it == born.end()) ? 0 : it->second;
+}
+
+void DiscoveryDaemon::readConnector() {
+    char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+    while (true) {
+        ssize_t bytes = recv(event_fd, buffer, sizeof(buffer), 0);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) {
+                limited_log(0, "%s: Process events were lost; rescanning.\n", logstr);
+                scan();
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                limited_log(0, "%s: Error reading process events: %d %s\n", logstr, errno, strerror(errno));
+            }
+            return;
+        }
+        int len = bytes;
+        for (struct nlmsghdr *header = (struct nlmsghdr *)buffer; NLMSG_OK(header, len); header = NLMSG_NEXT(header, len)) {
+            if (header->nlmsg_type == NLMSG_OVERRUN) {
+                limited_log(0, "%s: Process events were lost; rescanning.\n", logstr);
+                scan();
+                continue;
+            }
+            if (header->nlmsg_type != NLMSG_DONE) {
+                continue;
+            }
+            struct cn_msg *msg = (struct cn_msg *)NLMSG_DATA(header);
+            if ((msg->id.idx != CN_IDX_PROC) || (msg->id.val != CN_VAL_PROC)) {
+                continue;
+            }
+            const struct proc_event *event = (const struct proc_event *)msg->data;
+            switch (event->what) {
+            case proc_event::PROC_EVENT_FORK:
+                // Threads share the process's entry.
+                if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid) {
+                    forked(event->event_data.fork.parent_tgid, event->event_data.fork.child_tgid);
+                }
+                break;
+            case proc_event::PROC_EVENT_EXIT:
+                if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+                    exited(event->event_data.exit.process_tgid);
+                }
+                break;
+            // Discovery records the real IDs, as in the status file.
+            case proc_event::PROC_EVENT_UID:
+                ca.setIDs(event->event_data.id.process_tgid, event->event_data.id.r.ruid, -1);
+                break;
+            case proc_event::PROC_EVENT_GID:
+                ca.setIDs(event->event_data.id.process_tgid, -1, event->event_data.id.r.rgid);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void DiscoveryDaemon::applyEvent(const char *line) {
+    char what[8];
+    long pid, value = -1;
+    int fields = sscanf(line, "%7s %ld %ld", what, &pid, &value);
+    if ((fields < 1) || (what[0] == '#')) {
+        return;
+    }
+    if ((fields == 3) && !strcmp(what, "fork")) {
+        forked(pid, value);
+    } else if ((fields >= 2) && !strcmp(what, "exit")) {
+        exited(pid);
+    } else if ((fields == 3) && !strcmp(what, "uid")) {
+        ca.setIDs(pid, value, -1);
+    } else if ((fields == 3) && !strcmp(what, "gid")) {
+        ca.setIDs(pid, -1, value);
+    } else if ((fields >= 2) && !strcmp(what, "exec")) {
+        // Nothing discovery records changes on exec; setuid binaries also
+        // produce an ID change event.
+    } else {
+        limited_log(0, "%s: Unknown event: %s\n", logstr, line);
+    }
+}
+
+void DiscoveryDaemon::readReplay() {
+    char buffer[4096];
+    ssize_t bytes;
+    while ((bytes = read(event_fd, buffer, sizeof(buffer))) > 0) {
+        replay_buffer.append(buffer, bytes);
+        size_t start = 0, end;
+        while ((end = replay_buffer.find('\n', start)) != std::string::npos) {
+            applyEvent(replay_buffer.substr(start, end - start).c_str());
+            start = end + 1;
+        }
+        replay_buffer.erase(0, start);
+    }
+    if (bytes == 0) {
+        // End of the stream: no more events, but keep answering queries.
+        close(event_fd);
+        event_fd = -1;
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        limited_log(0, "%s: Error reading events: %d %s\n", logstr, errno, strerror(errno));
+    }
+}
+
+void DiscoveryDaemon::handleEvents() {
+    if (event_fd == -1) {
+        return;
+    }
+    if (replay) {
+        readReplay();
+    } else {
+        readConnector();
+    }
+}
+
+int DiscoveryDaemon::verifyAncestry(pid_t pid) {
+    pid_t curpid = pid;
+    for (unsigned depth = 0; depth < MAX_DEPTH; depth++) {
+        const ProcessEntry *entry = ca.find(curpid);
+        // The queried process is always re-read: its parent is about to be
+        // acted on.  The start time is only known once read from /proc.
+        if (!entry || !entry->starttime || (curpid == pid) || (bornAt(entry->ppid) > bornAt(curpid))) {
+            if ((entry = ca.refreshProcess(curpid)) == NULL) {
+                limited_log(0, "%s: Unable to read ancestor %d of %d.\n", logstr, curpid, pid);
+                return -1;
+            }
+            born[curpid] = sequence;
+        }
+        if ((curpid == 1) || (entry->ppid <= 0)) {
+            return 0;
+        }
+        curpid = entry->ppid;
+    }
+    limited_log(0, "%s: Error - ancestry of %d exceeds %d processes; possible loop.\n", logstr, pid, MAX_DEPTH);
+    return -1;
+}
+
+void DiscoveryDaemon::answer(pid_t pid, discovery_reply_t *reply) {
+    const ProcessEntry *entry, *parent;
+    memset(reply, 0, sizeof(*reply));
+    reply->magic = DISCOVERY_DAEMON_MAGIC;
+    if ((pid <= 1) || verifyAncestry(pid) ||
+        ((entry = ca.find(pid)) == NULL) || ((parent = ca.find(entry->ppid)) == NULL)) {
+        reply->status = ESRCH;
+        return;
+    }
+    reply->ppid = entry->ppid;
+    reply->parent_uid = parent->uid;
+    reply->parent_gid = parent->gid;
+    char *scratch = ca.findCondorScratch(pid);
+    if (!scratch || (strlen(scratch) >= sizeof(reply->scratch))) {
+        reply->status = ENOENT;
+    } else {
+        strcpy(reply->scratch, scratch);
+    }
+    free(scratch);
+}
+
+void DiscoveryDaemon::acceptClient() {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int fd;
+    if ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            limited_log(0, "%s: Unable to accept a query: %d %s\n", logstr, errno, strerror(errno));
+        }
+        return;
+    }
+    // The answer says where a job's updates go; the socket's mode already
+    // keeps others out, but do not rely on where it was created.
+    if ((getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) ||
+        ((cred.uid != 0) && (cred.uid != geteuid()))) {
+        limited_log(0, "%s: Refusing a query from UID %d.\n", logstr, (int)cred.uid);
+        close(fd);
+        return;
+    }
+    Client client = {fd, now_ms()};
+    clients.push_back(client);
+}
+
+void DiscoveryDaemon::serveClient(int fd) {
+    discovery_request_t request;
+    discovery_reply_t reply;
+    ssize_t bytes = recv(fd, &request, sizeof(request), 0);
+    if ((bytes != sizeof(request)) || (request.magic != DISCOVERY_DAEMON_MAGIC)) {
+        // Nothing sent: the client gave up waiting, which is not worth a line.
+        if (bytes > 0) {
+            limited_log(0, "%s: Malformed query.\n", logstr);
+        }
+        return;
+    }
+    // The fork of the querying process is queued before it can connect.
+    handleEvents();
+    answer(request.pid, &reply);
+    if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+        limited_log(0, "%s: Unable to answer the query for %d: %d %s\n", logstr, request.pid, errno, strerror(errno));
+    }
+}
+
+int DiscoveryDaemon::poll(int timeout_ms) {
+    std::vector<struct pollfd> fds;
+    struct pollfd pfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    pfd.fd = event_fd;
+    fds.push_back(pfd);
+    // Leave further clients in the backlog rather than run out of descriptors.
+    pfd.fd = (clients.size() < MAX_CLIENTS) ? listen_fd : -1;
+    fds.push_back(pfd);
+    for (size_t idx = 0; idx < clients.size(); idx++) {
+        pfd.fd = clients[idx].fd;
+        fds.push_back(pfd);
+    }
+    if (!clients.empty() && ((timeout_ms < 0) || (timeout_ms > CLIENT_TIMEOUT_MS))) {
+        timeout_ms = CLIENT_TIMEOUT_MS;
+    }
+    int ready = ::poll(&fds[0], fds.size(), timeout_ms);
+    if (ready == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        limited_log(0, "%s: poll failed: %d %s\n", logstr, errno, strerror(errno));
+        return -1;
+    }
+    if (fds[0].revents) {
+        handleEvents();
+    }
+    uint64_t now = now_ms();
+    std::vector<Client> waiting;
+    for (size_t idx = 0; idx < clients.size(); idx++) {
+        if (fds[idx + 2].revents) {
+            serveClient(clients[idx].fd);
+        } else if (now - clients[idx].since < CLIENT_TIMEOUT_MS) {
+            waiting.push_back(clients[idx]);
+            continue;
+        }
+        close(clients[idx].fd);
+    }
+    clients.swap(waiting);
+    if (fds[1].revents) {
+        acceptClient();
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef __DISCOVERY_DAEMON_H
+#define __DISCOVERY_DAEMON_H
+
+/*
+ * The discovery daemon: keeps the node's process tree up to date from fork,
+ * exit and ID change events, starting from one full scan of /proc, and
+ * answers findCondorScratch/getParentIDs queries from glexec over a Unix
+ * socket (see discovery_client.h).  A query then costs the plugin one round
+ * trip instead of a walk of /proc.
+ *
+ * Events come from the kernel's proc connector or, for testing against a
+ * synthetic process tree, from a stream of text lines:
+ *   fork <parent> <child>
+ *   exec <pid>
+ *   exit <pid>
+ *   uid <pid> <uid>
+ *   gid <pid> <gid>
+ *
+ * The tree is not trusted blindly: before answering, the queried process is
+ * re-read from /proc, as are ancestors known only from a fork event and any
+ * ancestor recorded as forked after its child (a PID since reused).
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "condor_discovery.h"
+#include "discovery_client.h"
+
+class DiscoveryDaemon {
+
+public:
+    DiscoveryDaemon();
+    ~DiscoveryDaemon();
+
+    // Subscribe to the proc connector.  Call before scan, so that no process
+    // started in between is missed.
+    int openConnector();
+    // Read events from fd (non-blocking) instead of the proc connector.
+    void setReplay(int fd);
+    // Rebuild the tree from a full scan of /proc.
+    int scan();
+    // Listen at path, replacing a stale socket.  Only root and the daemon's
+    // own user may query.
+    int listen(const char *path);
+    // Handle the events and queries that arrive within timeout_ms (-1 waits
+    // until something does).  Events are always handled before queries.
+    int poll(int timeout_ms);
+
+    void answer(pid_t pid, discovery_reply_t *reply);
+    size_t size() const {return ca.size();}
+
+private:
+    struct Client {
+        int fd;
+        uint64_t since;
+    };
+
+    void handleEvents();
+    void readConnector();
+    void readReplay();
+    void applyEvent(const char *line);
+    void forked(pid_t parent, pid_t child);
+    void exited(pid_t pid);
+    unsigned long bornAt(pid_t pid) const;
+    int verifyAncestry(pid_t pid);
+    void acceptClient();
+    void serveClient(int fd);
+
+    CondorAncestry ca;
+    // Order in which processes were forked (or last verified against /proc).
+    std::map<pid_t, unsigned long> born;
+    unsigned long sequence;
+    int event_fd;
+    bool replay;
+    std::string replay_buffer;
+    int listen_fd;
+    std::string socket_path;
+    std::vector<Client> clients;
+};
+
+#endif
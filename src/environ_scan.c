@@ -0,0 +1,196 @@
+
+/*
+ * lcmaps-condor-update
+ * Chunked, zero-copy reader for /proc/<pid>/environ.  Entry boundaries that
+ * may start one of the requested keys ("\0K") are located with SSE2/AVX2
+ * where available.
+ * This code is under the public domain
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define ENV_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#include "environ_scan.h"
+
+#define ENV_CHUNK 65536
+#define ENV_MAX_FIRSTS 8
+
+ssize_t read_environ(const char *path, char **buf) {
+  size_t size = ENV_CHUNK, len = 0;
+  char *data, *tmp;
+  ssize_t bytes;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    return -1;
+  }
+  if ((data = (char *)malloc(size + 1)) == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return -1;
+  }
+  while (1) {
+    if (len == size) {
+      size *= 2;
+      if ((tmp = (char *)realloc(data, size + 1)) == NULL) {
+        free(data);
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+      }
+      data = tmp;
+    }
+    if ((bytes = read(fd, data + len, size - len)) == -1) {
+      if (errno == EINTR) continue;
+      free(data);
+      close(fd);
+      return -1;
+    }
+    if (bytes == 0) break;
+    len += bytes;
+  }
+  close(fd);
+  data[len] = '\0';
+  *buf = data;
+  return len;
+}
+
+/* Candidate finders: return the offset of the first entry start at or after
+   pos whose first byte is one of firsts[], or len if there is none.  An
+   entry start is offset 0 or any byte following a NUL. */
+typedef size_t (*find_entry_fn)(const unsigned char *, size_t, size_t, const unsigned char *, size_t);
+
+static int is_wanted(unsigned char c, const unsigned char *firsts, size_t nfirsts) {
+  size_t k;
+  for (k = 0; k < nfirsts; k++) {
+    if (c == firsts[k]) return 1;
+  }
+  return 0;
+}
+
+static size_t find_entry_scalar(const unsigned char *buf, size_t pos, size_t len, const unsigned char *firsts, size_t nfirsts) {
+  for (; pos < len; pos++) {
+    if ((!pos || !buf[pos-1]) && is_wanted(buf[pos], firsts, nfirsts)) return pos;
+  }
+  return len;
+}
+
+/* Used when the keys start with too many distinct characters to filter on. */
+static size_t find_entry_any(const unsigned char *buf, size_t pos, size_t len, const unsigned char *firsts, size_t nfirsts) {
+  for (; pos < len; pos++) {
+    if (!pos || !buf[pos-1]) return pos;
+  }
+  return len;
+}
+
+#ifdef ENV_SCAN_X86
+static size_t find_entry_sse2(const unsigned char *buf, size_t pos, size_t len, const unsigned char *firsts, size_t nfirsts) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i want[ENV_MAX_FIRSTS];
+  size_t k;
+
+  if (pos == 0) {
+    if (len && is_wanted(buf[0], firsts, nfirsts)) return 0;
+    pos = 1;
+  }
+  for (k = 0; k < nfirsts; k++) want[k] = _mm_set1_epi8((char)firsts[k]);
+  // Compare the bytes before candidate positions against NUL and the
+  // candidates themselves against the wanted first characters.
+  while (pos + 16 <= len) {
+    __m128i prev = _mm_loadu_si128((const __m128i *)(buf + pos - 1));
+    __m128i cur = _mm_loadu_si128((const __m128i *)(buf + pos));
+    __m128i match = _mm_cmpeq_epi8(cur, want[0]);
+    for (k = 1; k < nfirsts; k++) match = _mm_or_si128(match, _mm_cmpeq_epi8(cur, want[k]));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(match, _mm_cmpeq_epi8(prev, zero)));
+    if (mask) return pos + __builtin_ctz(mask);
+    pos += 16;
+  }
+  return find_entry_scalar(buf, pos, len, firsts, nfirsts);
+}
+
+__attribute__((target("avx2")))
+static size_t find_entry_avx2(const unsigned char *buf, size_t pos, size_t len, const unsigned char *firsts, size_t nfirsts) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i want[ENV_MAX_FIRSTS];
+  size_t k;
+
+  if (pos == 0) {
+    if (len && is_wanted(buf[0], firsts, nfirsts)) return 0;
+    pos = 1;
+  }
+  for (k = 0; k < nfirsts; k++) want[k] = _mm256_set1_epi8((char)firsts[k]);
+  while (pos + 32 <= len) {
+    __m256i prev = _mm256_loadu_si256((const __m256i *)(buf + pos - 1));
+    __m256i cur = _mm256_loadu_si256((const __m256i *)(buf + pos));
+    __m256i match = _mm256_cmpeq_epi8(cur, want[0]);
+    for (k = 1; k < nfirsts; k++) match = _mm256_or_si256(match, _mm256_cmpeq_epi8(cur, want[k]));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(match, _mm256_cmpeq_epi8(prev, zero)));
+    if (mask) return pos + __builtin_ctz(mask);
+    pos += 32;
+  }
+  return find_entry_sse2(buf, pos, len, firsts, nfirsts);
+}
+#endif
+
+static find_entry_fn select_find_entry(void) {
+#ifdef ENV_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return find_entry_avx2;
+  return find_entry_sse2;
+#else
+  return find_entry_scalar;
+#endif
+}
+
+size_t environ_lookup(const char *buf, size_t len, const char * const *keys, size_t nkeys, env_view_t *views) {
+  static find_entry_fn best_find_entry = NULL;
+  find_entry_fn find_entry;
+  const unsigned char *data = (const unsigned char *)buf;
+  unsigned char firsts[ENV_MAX_FIRSTS];
+  size_t nfirsts = 0, found = 0, pos = 0, idx, k;
+
+  if (!best_find_entry) best_find_entry = select_find_entry();
+  find_entry = best_find_entry;
+
+  for (idx = 0; idx < nkeys; idx++) {
+    views[idx].value = NULL;
+    views[idx].len = 0;
+    for (k = 0; k < nfirsts; k++) {
+      if (firsts[k] == (unsigned char)keys[idx][0]) break;
+    }
+    if (k == nfirsts) {
+      if (nfirsts == ENV_MAX_FIRSTS) {
+        // Too many distinct leading characters to vectorize; check every entry.
+        find_entry = find_entry_any;
+        continue;
+      }
+      firsts[nfirsts++] = (unsigned char)keys[idx][0];
+    }
+  }
+
+  while ((found < nkeys) && ((pos = find_entry(data, pos, len, firsts, nfirsts)) < len)) {
+    const char *entry = buf + pos;
+    size_t remaining = len - pos;
+    for (idx = 0; idx < nkeys; idx++) {
+      size_t key_len = strlen(keys[idx]);
+      if (views[idx].value || (remaining <= key_len) || (entry[key_len] != '=') ||
+          (memcmp(entry, keys[idx], key_len) != 0)) {
+        continue;
+      }
+      views[idx].value = entry + key_len + 1;
+      views[idx].len = strnlen(views[idx].value, remaining - key_len - 1);
+      found++;
+      break;
+    }
+    pos++;
+  }
+  return found;
+}
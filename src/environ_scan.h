@@ -0,0 +1,35 @@
+#ifndef __ENVIRON_SCAN_H
+#define __ENVIRON_SCAN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A value found in an environment block; points into the buffer returned
+   by read_environ() and is NUL-terminated there.  value is NULL if the
+   variable is not set. */
+typedef struct {
+    const char *value;
+    size_t len;
+} env_view_t;
+
+/* Read an entire /proc/<pid>/environ style file with large reads into a
+   single buffer.  On success returns the number of bytes of environment
+   and sets *buf (owned by the caller; always NUL-terminated, even past a
+   truncated last entry).  Returns -1 with errno set on failure. */
+ssize_t read_environ(const char *path, char **buf);
+
+/* Look up several variables in a NUL-separated environment block in one
+   pass.  views[i] is set for keys[i].  Only exact "KEY=" entries match, so
+   a key never matches a longer variable name it is a prefix of.  Returns
+   the number of keys found. */
+size_t environ_lookup(const char *buf, size_t len, const char * const *keys, size_t nkeys, env_view_t *views);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
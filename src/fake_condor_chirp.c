@@ -0,0 +1,53 @@
+
+/*
+ * lcmaps-condor-update
+ * Stand-in for condor_chirp, for the stress harness:
+ *   condor_chirp set_job_attr attr value
+ * Finds the chirp config the way condor_chirp does (_CONDOR_CHIRP_CONFIG, or
+ * .chirp.config in _CONDOR_SCRATCH_DIR), sends the update with the native
+ * client, and appends a byte to <config>.execs so executions can be counted.
+ * This code is under the public domain
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "chirp_client.h"
+
+int main(int argc, char *argv[]) {
+  char config[PATH_MAX], counter[PATH_MAX];
+  const char *env;
+  int fd, rc;
+
+  if ((argc != 4) || strcmp(argv[1], "set_job_attr")) {
+    fprintf(stderr, "Usage: %s set_job_attr attr value\n", argv[0]);
+    return 1;
+  }
+  if ((env = getenv("_CONDOR_CHIRP_CONFIG"))) {
+    rc = snprintf(config, PATH_MAX, "%s", env);
+  } else if ((env = getenv("_CONDOR_SCRATCH_DIR"))) {
+    rc = snprintf(config, PATH_MAX, "%s/.chirp.config", env);
+  } else {
+    fprintf(stderr, "No chirp config in the environment\n");
+    return 1;
+  }
+  if ((rc >= PATH_MAX) || (snprintf(counter, PATH_MAX, "%s.execs", config) >= PATH_MAX)) {
+    return 1;
+  }
+  if ((fd = open(counter, O_WRONLY | O_APPEND | O_CREAT, 0644)) != -1) {
+    if (write(fd, "x", 1) != 1) {
+      perror("Unable to count the execution");
+    }
+    close(fd);
+  }
+  if ((fd = chirp_client_connect(config)) == -1) {
+    return 1;
+  }
+  rc = chirp_client_set_job_attr(fd, argv[2], argv[3]);
+  chirp_client_close(fd);
+  return rc ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "fake_proc.h"
+
+static int write_file(const std::string &path, const char *data, size_t len) {
+    int fd;
+    if ((fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1) {
+        return -1;
+    }
+    while (len) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            close(fd);
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return close(fd);
+}
+
+// mkdir -p
+static int make_dirs(const std::string &path) {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        std::string prefix = path.substr(0, pos);
+        if ((mkdir(prefix.c_str(), 0755) == -1) && (errno != EEXIST)) {
+            return -1;
+        }
+        if (pos == std::string::npos) {
+            return 0;
+        }
+    }
+}
+
+// Roughly the size and layout of a status file on a current kernel.
+static const char * status_template =
+    "Name:\t%s\n"
+    "Umask:\t0022\n"
+    "State:\tS (sleeping)\n"
+    "Tgid:\t%d\n"
+    "Ngid:\t0\n"
+    "Pid:\t%d\n"
+    "PPid:\t%d\n"
+    "TracerPid:\t0\n"
+    "Uid:\t%d\t%d\t%d\t%d\n"
+    "Gid:\t%d\t%d\t%d\t%d\n"
+    "FDSize:\t64\n"
+    "Groups:\t \n"
+    "NStgid:\t%s\n"
+    "NSpid:\t%s\n"
+    "NSpgid:\t%s\n"
+    "NSsid:\t%s\n"
+    "VmPeak:\t   25272 kB\n"
+    "VmSize:\t   25272 kB\n"
+    "VmLck:\t       0 kB\n"
+    "VmPin:\t       0 kB\n"
+    "VmHWM:\t    9112 kB\n"
+    "VmRSS:\t    9112 kB\n"
+    "RssAnon:\t    1436 kB\n"
+    "RssFile:\t    7676 kB\n"
+    "RssShmem:\t       0 kB\n"
+    "VmData:\t    1532 kB\n"
+    "VmStk:\t     132 kB\n"
+    "VmExe:\t     884 kB\n"
+    "VmLib:\t    2856 kB\n"
+    "VmPTE:\t      80 kB\n"
+    "VmSwap:\t       0 kB\n"
+    "HugetlbPages:\t       0 kB\n"
+    "CoreDumping:\t0\n"
+    "THP_enabled:\t1\n"
+    "Threads:\t1\n"
+    "SigQ:\t0/63448\n"
+    "SigPnd:\t0000000000000000\n"
+    "ShdPnd:\t0000000000000000\n"
+    "SigBlk:\t0000000000000000\n"
+    "SigIgn:\t0000000000001000\n"
+    "SigCgt:\t0000000180014002\n"
+    "CapInh:\t0000000000000000\n"
+    "CapPrm:\t0000000000000000\n"
+    "CapEff:\t0000000000000000\n"
+    "CapBnd:\t000001ffffffffff\n"
+    "CapAmb:\t0000000000000000\n"
+    "NoNewPrivs:\t0\n"
+    "Seccomp:\t0\n"
+    "Seccomp_filters:\t0\n"
+    "Speculation_Store_Bypass:\tthread vulnerable\n"
+    "Cpus_allowed:\tff\n"
+    "Cpus_allowed_list:\t0-7\n"
+    "Mems_allowed:\t00000000,00000001\n"
+    "Mems_allowed_list:\t0\n"
+    "voluntary_ctxt_switches:\t120\n"
+    "nonvoluntary_ctxt_switches:\t3\n";
+
+// ns_pids: the PIDs of the process in the PID namespaces nested below the
+// proc root's, outermost first.
+static int make_process(const std::string &root, pid_t pid, pid_t ppid, uid_t uid, gid_t gid,
+                        const char *name, unsigned long long starttime, const std::string *environ,
+                        const std::vector<pid_t> &ns_pids = std::vector<pid_t>()) {
+    char buf[4096];
+    int len;
+    std::string dir = root + "/" + std::to_string(pid);
+    if (mkdir(dir.c_str(), 0755) == -1) {
+        return -1;
+    }
+    std::string ids = std::to_string(pid);
+    for (size_t idx = 0; idx < ns_pids.size(); idx++) {
+        ids += "\t" + std::to_string(ns_pids[idx]);
+    }
+    len = snprintf(buf, sizeof(buf), status_template, name, pid, pid, ppid,
+                   uid, uid, uid, uid, gid, gid, gid, gid, ids.c_str(), ids.c_str(), ids.c_str(), ids.c_str());
+    if (write_file(dir + "/status", buf, len)) {
+        return -1;
+    }
+    len = snprintf(buf, sizeof(buf),
+                   "%d (%s) S %d %d %d 0 -1 4194560 1234 0 0 0 10 5 0 0 20 0 1 0 %llu 25878528 2278 "
+                   "18446744073709551615 1 1 0 0 0 0 0 4096 81922 0 0 0 17 3 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+                   pid, name, ppid, pid, pid, starttime);
+    if (write_file(dir + "/stat", buf, len)) {
+        return -1;
+    }
+    if (environ && write_file(dir + "/environ", environ->data(), environ->size())) {
+        return -1;
+    }
+    return 0;
+}
+
+// The cgroup file of a process in the given cgroup, as seen on a v1 or v2 host.
+static int write_cgroup(const std::string &root, pid_t pid, int version, const std::string &cgroup) {
+    std::string contents;
+    if (version == 1) {
+        contents = "12:pids:" + cgroup + "\n11:memory:" + cgroup + "\n4:cpu,cpuacct:" + cgroup +
+                   "\n1:name=systemd:/system.slice/condor.service\n";
+    } else {
+        contents = "0::" + cgroup + "\n";
+    }
+    return write_file(root + "/" + std::to_string(pid) + "/cgroup", contents.data(), contents.size());
+}
+
+// A NUL-separated environment of about size bytes ending with the given variables.
+static std::string make_environ(size_t size, const std::string &tail) {
+    std::string env;
+    unsigned idx = 0;
+    while (env.size() + tail.size() < size) {
+        env += "PADDING_VARIABLE_" + std::to_string(idx++) + "=/some/reasonably/long/value/for/a/path/like/variable";
+        env.push_back('\0');
+    }
+    return env + tail;
+}
+
+int makeFakeProc(const FakeProcOptions &opts, FakeProcTree &tree) {
+    const char *tmpdir = getenv("TMPDIR");
+    std::string templ = std::string(tmpdir ? tmpdir : "/tmp") + "/fake_proc.XXXXXX";
+    std::vector<char> path(templ.begin(), templ.end());
+    path.push_back('\0');
+    if (mkdtemp(&path[0]) == NULL) {
+        return -1;
+    }
+    tree.root = &path[0];
+    tree.execute_dir = opts.make_execute ? tree.root + "/execute" : "/var/lib/condor/execute";
+
+    // init -> condor_master -> condor_startd -> condor_starter -> pilot -> ... -> glexec
+    pid_t pid = 1;
+    unsigned long long starttime = 100;
+    std::string plain_env = make_environ(opts.environ_size, std::string("HOME=/home/pilot") + '\0');
+    std::string starter_env = make_environ(opts.environ_size,
+        std::string("_CONDOR_EXECUTE=") + tree.execute_dir + '\0' + "_CONDOR_SLOT=slot1_1" + '\0');
+    if (make_process(tree.root, 1, 0, 0, 0, "systemd", starttime++, &plain_env) ||
+        make_process(tree.root, 2, 1, 0, 0, "condor_master", starttime++, &plain_env) ||
+        make_process(tree.root, 3, 2, 0, 0, "condor_startd", starttime++, &plain_env) ||
+        make_process(tree.root, 4, 3, 0, 0, "condor_starter", starttime++, &starter_env)) {
+        removeFakeProc(tree);
+        return -1;
+    }
+    tree.starter = 4;
+    if (opts.make_execute && make_dirs(tree.execute_dir + "/dir_" + std::to_string(tree.starter))) {
+        removeFakeProc(tree);
+        return -1;
+    }
+    pid = 5;
+    tree.pilot = pid;
+    // Container k (1-based) is started by the process at level k - 1 and has
+    // its init at level k; the innermost one passes the chirp config through.
+    unsigned containers = (opts.containers < opts.depth) ? opts.containers : 0;
+    std::string container_env = make_environ(opts.environ_size,
+        std::string("_CONDOR_CHIRP_CONFIG=/srv/.chirp.config") + '\0' + "_CONDOR_SCRATCH_DIR=/srv" + '\0');
+    tree.chirp_config = containers ? "/srv/.chirp.config" : "";
+    for (unsigned level = 0; level <= opts.depth; level++, pid++) {
+        const char *name = (level == opts.depth) ? "glexec" : "pilot";
+        std::vector<pid_t> ns_pids;
+        for (unsigned ns = 1; (ns <= containers) && (ns <= level); ns++) {
+            ns_pids.push_back(level - ns + 1);
+        }
+        const std::string *env = (containers && (level == containers)) ? &container_env : &plain_env;
+        if (make_process(tree.root, pid, pid - 1, opts.user_uid, opts.user_gid, name, starttime++, env, ns_pids)) {
+            removeFakeProc(tree);
+            return -1;
+        }
+    }
+    tree.leaf = pid - 1;
+
+    // HTCondor's cgroup for the slot: the job is in it, the daemons are not.
+    if (opts.cgroup_version) {
+        std::string job_cgroup = "/htcondor/condor_var_lib_condor_execute_slot1_1@fake.node";
+        tree.cgroup_root = tree.root + "/cgroup";
+        std::string job_dir = tree.cgroup_root + ((opts.cgroup_version == 1) ? "/pids" : "") + job_cgroup;
+        std::string procs;
+        for (pid_t daemon = 1; daemon < tree.pilot; daemon++) {
+            if (write_cgroup(tree.root, daemon, opts.cgroup_version, "/system.slice/condor.service")) {
+                removeFakeProc(tree);
+                return -1;
+            }
+        }
+        for (pid_t job = tree.pilot; job <= tree.leaf; job++) {
+            procs += std::to_string(job) + "\n";
+            if (write_cgroup(tree.root, job, opts.cgroup_version, job_cgroup)) {
+                removeFakeProc(tree);
+                return -1;
+            }
+        }
+        if (make_dirs(job_dir) || write_file(job_dir + "/cgroup.procs", procs.data(), procs.size())) {
+            removeFakeProc(tree);
+            return -1;
+        }
+    }
+
+    // Everything else on the node: system daemons and other slots' jobs.
+    for (; pid <= (pid_t)opts.processes; pid++) {
+        uid_t uid = (pid % 3) ? 2000 + (pid % 64) : 0;
+        pid_t ppid = (pid % 7) ? 1 : 3;
+        if (make_process(tree.root, pid, ppid, uid, uid, "worker", starttime++, NULL)) {
+            removeFakeProc(tree);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int addFakeProcess(const FakeProcTree &tree, pid_t pid, pid_t ppid, uid_t uid, gid_t gid, const char *name) {
+    // Later than anything makeFakeProc creates, and distinct per process.
+    static unsigned long long starttime = 1000000;
+    std::string plain_env = make_environ(0, std::string("HOME=/home/pilot") + '\0');
+    return make_process(tree.root, pid, ppid, uid, gid, name, starttime++, &plain_env);
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+void removeFakeProc(const FakeProcTree &tree) {
+    if (!tree.root.empty()) {
+        nftw(tree.root.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+    }
+}
+
+void removeFakeProcess(const FakeProcTree &tree, pid_t pid) {
+    std::string dir = tree.root + "/" + std::to_string(pid);
+    nftw(dir.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,46 @@
+#ifndef __FAKE_PROC_H
+#define __FAKE_PROC_H
+
+/*
+ * Generator for synthetic /proc trees, used by the benchmarks to exercise
+ * discovery at node sizes that are not available on a development box.
+ */
+
+#include <sys/types.h>
+#include <string>
+
+struct FakeProcOptions {
+    FakeProcOptions() : processes(1000), depth(4), environ_size(16384), user_uid(1000), user_gid(1000), cgroup_version(2), containers(0), make_execute(false) {}
+
+    unsigned processes;  // Total number of processes in the tree.
+    unsigned depth;      // Processes between the starter and the glexec invocation.
+    size_t environ_size; // Size of the environ file of each process in the job's chain.
+    uid_t user_uid;      // Identity of the pilot job.
+    gid_t user_gid;
+    int cgroup_version;  // 1 or 2: put the job in an HTCondor cgroup; 0: no cgroup files.
+    unsigned containers; // Nested PID namespaces in the job's chain; must be less than depth.
+    bool make_execute;   // Create a real execute directory, with the starter's dir_<pid>, under root.
+};
+
+struct FakeProcTree {
+    std::string root;        // Use as the proc root.
+    std::string execute_dir; // _CONDOR_EXECUTE of the starter.
+    std::string cgroup_root; // Use as the cgroup root.
+    std::string chirp_config; // Passed into the innermost container; empty without containers.
+    pid_t starter;           // The (root-owned) condor_starter.
+    pid_t pilot;             // The starter's child: the pilot job.
+    pid_t leaf;              // The glexec invocation at the bottom of the chain.
+};
+
+// Creates the tree in a fresh directory under $TMPDIR (or /tmp); returns 0 on success.
+int makeFakeProc(const FakeProcOptions &, FakeProcTree &);
+
+// Removes the directory created by makeFakeProc.
+void removeFakeProc(const FakeProcTree &);
+
+// Adds a process to (or removes it from) an existing tree, e.g. a real
+// process standing in for glexec.  Fails if pid is already in the tree.
+int addFakeProcess(const FakeProcTree &, pid_t pid, pid_t ppid, uid_t uid, gid_t gid, const char *name);
+void removeFakeProcess(const FakeProcTree &, pid_t pid);
+
+#endif
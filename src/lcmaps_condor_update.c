@@ -15,9 +15,14 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <pwd.h>
 #include <linux/limits.h>
 
 #include "lcmaps/lcmaps_modules.h"
@@ -25,9 +30,14 @@
 #include "lcmaps/lcmaps_arguments.h"
 
 #include "condor_discovery.h"
-
-#define CONDOR_CHIRP_PATH "/usr/libexec/condor/condor_chirp"
-#define CONDOR_CHIRP_NAME "condor_chirp"
+#include "starter_update.h"
+#include "phase_stats.h"
+#include "user_cache.h"
+#include "log_limit.h"
+
+#ifndef CONDOR_UPDATE_HELPER_PATH
+#define CONDOR_UPDATE_HELPER_PATH "/usr/libexec/lcmaps-plugins-condor-update/condor_update_helper"
+#endif
 #define CONDOR_SCRATCH_DIR "_CONDOR_SCRATCH_DIR"
 
 static const char * logstr = "lcmaps-condor-update";
@@ -39,252 +49,447 @@ static const char * logstr = "lcmaps-condor-update";
 
 #define TIME_BUFFER_SIZE 12
 
-static int update_starter_child(const char * attr, const char *val, int fd, const char * scratch_dir, pid_t ppid) {
-  size_t len;
-  int result = 1;
-  char result_buf[TIME_BUFFER_SIZE];
-  uid_t uid;
-  gid_t gid;
+static update_options_t update_options = {UPDATE_BACKEND_NATIVE_CHIRP, 0, CLASSAD_GLEXEC_TIME, 0, NULL, NULL};
 
-  if (getParentIDs(ppid, &uid, &gid)) {
-    lcmaps_log(0, "%s: Unable to determine target user UID/GID\n", logstr);
-    return 1;
-  } 
-  if (setgid(gid) == -1) {
-    lcmaps_log(0, "%s: Unable to switch to user's GID (%d): %d %s\n", logstr, gid, errno, strerror(errno));
-    result = errno;
-    goto condor_update_fail_child;
+// How the privilege-dropped child is started.
+#define SPAWN_MODE_FORK   0 // fork() the plugin's host process
+#define SPAWN_MODE_HELPER 1 // posix_spawn() condor_update_helper
+
+static int spawn_mode = SPAWN_MODE_FORK;
+
+// Where the per-invocation timing summary goes.
+static int stats_level = 2;
+
+// Messages per second and at once allowed through limited_log.
+static int log_rate = LOG_LIMIT_RATE;
+static int log_burst = LOG_LIMIT_BURST;
+
+// Budget for the whole of plugin_run, in milliseconds; 0 means none.
+static long timeout_ms = 0;
+// After killing a child that overran the budget, how long to wait to reap it.
+#define KILL_GRACE_US 100000
+static char stats_file[PATH_MAX] = "";
+
+// Name of an LCMAPS run argument (char *) that holds the name of the mapped
+// account, e.g. requested_username; empty for none.
+static char username_arg[64] = "";
+// How long an entry of the node-wide user cache is trusted, in seconds.
+static long user_cache_ttl = 600;
+
+// File written by the file-drop backend, in the job's scratch directory.
+static char drop_name[NAME_MAX] = "";
+
+#define USERNAME_BUFFER_SIZE 256
+#define PASSWD_BUFFER_MAX (1024 * 1024)
+
+/*
+ * The name and primary GID of uid from NSS.  getpwuid_r, as LCMAPS may be
+ * hosted by a threaded process.
+ */
+static int lookup_user(uid_t uid, char *username, size_t len, gid_t *gid) {
+  struct passwd pwd, *result = NULL;
+  long size = sysconf(_SC_GETPW_R_SIZE_MAX);
+  char *buf = NULL;
+  int rc;
+
+  if (size <= 0) {
+    size = 16384;
   }
-  if (setuid(uid) == -1) {
-    lcmaps_log(0, "%s: Unable to switch to user's UID (%d): %d %s\n", logstr, uid, errno, strerror(errno));
-    result = errno;
-    goto condor_update_fail_child;
-  }
-
-  int use_chirp_config = 0;
-  char path[PATH_MAX];
-  struct stat chirp_file;
-  if (stat(scratch_dir, &chirp_file) == -1)
-  {
-    lcmaps_log(0, "%s: Scratch location %s not found (errno=%d, %s).\n", logstr, scratch_dir, errno, strerror(errno));
-    goto condor_update_fail_child;
-  }
-  if (S_ISREG(chirp_file.st_mode))
-  {
-    if (snprintf(path, PATH_MAX, "%s", scratch_dir) >= PATH_MAX)
-    {
-      lcmaps_log(0, "%s: Chirp config filename overly long.\n", logstr);
-      goto condor_update_fail_child;
+  while (1) {
+    if ((buf = (char *)malloc(size)) == NULL) {
+      limited_log(0, "%s: Malloc failed for the passwd lookup.\n", logstr);
+      return 1;
     }
-    use_chirp_config = 1;
-  }
-  else if (snprintf(path, PATH_MAX, "%s/chirp.config", scratch_dir) >= PATH_MAX)
-  {
-    lcmaps_log(0, "%s: Overly long scratch dir: %s\n", logstr, scratch_dir);
-    goto condor_update_fail_child;
-  }
-  else if (stat(path, &chirp_file) == -1)
-  {
-    if (snprintf(path, PATH_MAX, "%s/.chirp.config", scratch_dir) >= PATH_MAX)
-    {
-      lcmaps_log(0, "%s: Overly long scratch dir: %s\n", logstr, scratch_dir);
-      goto condor_update_fail_child;
+    if (((rc = getpwuid_r(uid, &pwd, buf, size, &result)) != ERANGE) || (size >= PASSWD_BUFFER_MAX)) {
+      break;
     }
+    free(buf);
+    size *= 2;
   }
-
-  if (access(path, O_RDONLY) == -1) {
-    lcmaps_log(0, "%s: Unable to access chirp config %s\n", logstr, path);
-    goto condor_update_fail_child;
-  }
-  char environ_tmp[PATH_MAX];
-  if (use_chirp_config)
-  {
-    if (snprintf(environ_tmp, PATH_MAX, "_CONDOR_CHIRP_CONFIG=%s", scratch_dir) >= PATH_MAX)
-    {
-      lcmaps_log(0, "%s: Overly long chirp config path: %s\n", logstr, scratch_dir);
-      goto condor_update_fail_child;
+  if (!result) {
+    if (rc) {
+      limited_log(0, "%s: Fatal error: lookup of UID %d failed: %d %s\n", logstr, uid, rc, strerror(rc));
+    } else {
+      limited_log(0, "%s: Fatal error: unable to find corresponding username for UID %d.\n", logstr, uid);
     }
+    free(buf);
+    return 1;
   }
-  else if (snprintf(environ_tmp, PATH_MAX, "_CONDOR_SCRATCH_DIR=%s", scratch_dir) >= PATH_MAX) {
-    lcmaps_log(0, "%s: Overly long scratch dir: %s\n", logstr, scratch_dir);
-    goto condor_update_fail_child;
-  }
-  char * environ[2] = {environ_tmp, NULL};
-
-  char * my_attr = (char *)malloc(strlen(attr) + 1); strcpy(my_attr, attr);
-  char *my_val = (char *)malloc(strlen(val) + 1); strcpy(my_val, val);
-  char *const argv[] = {CONDOR_CHIRP_NAME,
-               "set_job_attr",
-               my_attr,
-               my_val,
-               NULL
-              };
-
-  // Nuke fd 1 and 2 to prevent condor_chirp from spilling out information to stdout/err
-  // Writing to stdout/err for a successful execution causes condor glexec integration to choke.
-  int fd_null;
-  if ((fd_null = open("/dev/null", O_WRONLY)) == -1) {
-    lcmaps_log(0, "%s: Opening of /dev/null failed: %d %s\n", logstr, errno, strerror(errno));
-    result = errno;
-    goto condor_update_fail_child;
-  }
-  if (dup2(fd_null, 1) == -1) {
-    lcmaps_log(0, "%s: Duping of /dev/null to stdout failed: %d %s\n", logstr, errno, strerror(errno));
-    result = errno;
-    goto condor_update_fail_child;
-  }
-  if (dup2(fd_null, 2) == -1) {
-    lcmaps_log(0, "%s: Duping of /dev/null to stderr failed: %d %s\n", logstr, errno, strerror(errno));
-    result = errno;
-    goto condor_update_fail_child;
-  }
-
-  // Cheap daemonize - causes condor_chirp to attach to init to avoid zombies
-  int fork_pid = fork();
-  if (fork_pid == -1) {
-    lcmaps_log(0, "%s: Daemonization of condor_chirp failed: %d %s\n", logstr, errno, strerror(errno));
-    result = errno;
-    goto condor_update_fail_child;
-  } else if (fork_pid) { // Parent
-    _exit(0);
-  }
-
-  if ((result = execve(CONDOR_CHIRP_PATH, argv, environ)) == -1) {
-    lcmaps_log(0, "%s: Exec of condor_chirp failed: %d %s\n", logstr, errno, strerror(errno));
-  }
-  result = errno;
-
-condor_update_fail_child:
-  len = snprintf(result_buf, TIME_BUFFER_SIZE, "%d", result);
-  if (write(fd, result_buf, len) == -1) {
-    lcmaps_log(0, "%s: Unable to return failed result to parent: %d %s\n", logstr, errno, strerror(errno));
+  if (snprintf(username, len, "%s", pwd.pw_name) >= (int)len) {
+    limited_log(0, "%s: Username of UID %d is too long.\n", logstr, uid);
+    free(buf);
+    return 1;
   }
-  _exit(result);
+  *gid = pwd.pw_gid;
+  free(buf);
+  return 0;
 }
 
-int get_user_ids(uid_t *uid, gid_t *gid, char ** username) {
+/*
+ * The mapped UID and GID from the LCMAPS credential data, and the name of
+ * the account for glexec_user.  The credential data has no account name, so
+ * the name comes, in order of preference, from the node-wide user cache,
+ * from the run argument set with -username-arg, or from NSS, where a cold
+ * lookup through sssd or LDAP can block glexec for a long time.
+ */
+int get_user_ids(int argc, lcmaps_argument_t *argv, uid_t *uid, gid_t *gid, char *username, size_t len) {
   int count = 0;
   uid_t internal_uid;
-  struct passwd *user_info;
+  gid_t pw_gid;
+  char pw_name[USERNAME_BUFFER_SIZE];
+  int need_name = (username != NULL), need_gid = 0;
   if (!uid)
     uid = &internal_uid;
   uid_t *uid_array;
   lcmaps_log_debug(2, "%s: Acquiring the UID from LCMAPS\n", logstr);
   uid_array = (uid_t *)getCredentialData(UID, &count);
   if (count != 1) {
-    lcmaps_log(0, "%s: No UID set yet; must map to a UID before running the process tracking module.\n", logstr);
+    limited_log(0, "%s: No UID set yet; must map to a UID before running the process tracking module.\n", logstr);
     return 1;
   }
   *uid = uid_array[0];
-  if ((user_info = getpwuid(*uid)) == NULL) {
-    lcmaps_log(0, "%s: Fatal error: unable to find corresponding username for UID %d.\n", logstr, *uid);
-    return 1;
+
+  if (gid) {
+    gid_t *gid_array = (gid_t *)getCredentialData(PRI_GID, &count);
+    if (count <= 0) {
+      need_gid = 1;
+    } else {
+      *gid = gid_array[0];
+    }
   }
-  if (username)
-    *username = user_info->pw_name;
 
-  if (!gid)
+  // The run argument names the requested account, which need not be the
+  // mapped one (pool accounts); a cached name for the UID takes precedence.
+  const char *arg_name = NULL;
+  if (need_name && username_arg[0]) {
+    char **arg_value = (char **)lcmaps_getArgValue(username_arg, "char *", argc, argv);
+    if (arg_value && *arg_value && **arg_value && (strlen(*arg_value) < len)) {
+      arg_name = *arg_value;
+    } else {
+      lcmaps_log_debug(2, "%s: No username in %s; looking up UID %d.\n", logstr, username_arg, *uid);
+    }
+  }
+  if (!need_name && !need_gid) {
     return 0;
+  }
 
-  gid_t *gid_array = (gid_t *)getCredentialData(PRI_GID, &count);
-  if (count <= 0) {
-      *gid = user_info->pw_gid;
+  time_t now = time(NULL);
+  if (!user_cache_lookup(*uid, now, user_cache_ttl, pw_name, sizeof(pw_name), &pw_gid)) {
+    stats_count(STATS_USER_CACHE_HITS, 1);
+    if (arg_name && strcmp(arg_name, pw_name)) {
+      lcmaps_log_debug(2, "%s: %s names %s, but UID %d is %s.\n", logstr, username_arg, arg_name, *uid, pw_name);
+    }
+  } else if (arg_name && !need_gid) {
+    // Not verified against the UID; better than blocking on NSS.
+    strcpy(username, arg_name);
+    return 0;
+  } else if (lookup_user(*uid, pw_name, sizeof(pw_name), &pw_gid)) {
+    return 1;
   } else {
-      *gid = gid_array[0];
+    user_cache_store(*uid, pw_name, pw_gid, now);
+  }
+  if (need_name) {
+    if (strlen(pw_name) >= len) {
+      limited_log(0, "%s: Username of UID %d is too long.\n", logstr, *uid);
+      return 1;
+    }
+    strcpy(username, pw_name);
+  }
+  if (need_gid) {
+    *gid = pw_gid;
   }
   return 0;
 }
 
-int update_starter(const char * attr, const char * val) {
+/*
+ * Start condor_update_helper to do the work of update_starter_child().  By the
+ * time we run, glexec has loaded LCMAPS, VOMS and every other plugin, so a
+ * fork() has to copy page tables for all of that; posix_spawn() uses vfork
+ * semantics and costs the same regardless of our size.  The helper starts as
+ * root and drops privileges itself.  Returns the helper's PID, or -1.
+ */
+#define HELPER_MAX_OPTIONS 10 // program name, -e or -d name, -s, -t attr, -i seconds, -h attr
+
+static pid_t spawn_update_helper(const classad_update_t *updates, size_t count, int fd, const char * scratch_dir, uid_t uid, gid_t gid) {
+  char fd_string[TIME_BUFFER_SIZE], uid_string[TIME_BUFFER_SIZE], gid_string[TIME_BUFFER_SIZE];
+  char interval_string[TIME_BUFFER_SIZE];
+  char * helper_env[] = {NULL};
+  char ** helper_argv;
+  posix_spawn_file_actions_t actions;
+  size_t idx, argc = 0;
+  int status_fd, rc;
+  pid_t helper_pid = -1;
+
+  // The status pipe is close-on-exec; hand the helper a copy that is not.
+  if ((status_fd = dup(fd)) == -1) {
+    limited_log(0, "%s: Failed to duplicate status pipe: %d %s\n", logstr, errno, strerror(errno));
+    return -1;
+  }
+  if ((helper_argv = (char **)malloc((HELPER_MAX_OPTIONS + 4 + 2*count + 1) * sizeof(char *))) == NULL) {
+    limited_log(0, "%s: Malloc failed for helper arguments.\n", logstr);
+    close(status_fd);
+    return -1;
+  }
+  snprintf(fd_string, TIME_BUFFER_SIZE, "%d", status_fd);
+  snprintf(uid_string, TIME_BUFFER_SIZE, "%u", (unsigned)uid);
+  snprintf(gid_string, TIME_BUFFER_SIZE, "%u", (unsigned)gid);
+  snprintf(interval_string, TIME_BUFFER_SIZE, "%ld", update_options.throttle_interval);
+  helper_argv[argc++] = "condor_update_helper";
+  if (update_options.backend == UPDATE_BACKEND_EXEC_CHIRP) {
+    helper_argv[argc++] = "-e";
+  } else if (update_options.backend == UPDATE_BACKEND_FILE_DROP) {
+    helper_argv[argc++] = "-d";
+    helper_argv[argc++] = (char *)(update_options.drop_name ? update_options.drop_name : UPDATE_DROP_NAME);
+  }
+  if (update_options.suppress) {
+    helper_argv[argc++] = "-s";
+    helper_argv[argc++] = "-t";
+    helper_argv[argc++] = (char *)update_options.throttle_attr;
+    helper_argv[argc++] = "-i";
+    helper_argv[argc++] = interval_string;
+  }
+  if (update_options.history_attr) {
+    helper_argv[argc++] = "-h";
+    helper_argv[argc++] = (char *)update_options.history_attr;
+  }
+  helper_argv[argc++] = fd_string;
+  helper_argv[argc++] = uid_string;
+  helper_argv[argc++] = gid_string;
+  helper_argv[argc++] = (char *)scratch_dir;
+  for (idx = 0; idx < count; idx++) {
+    helper_argv[argc++] = (char *)updates[idx].attr;
+    helper_argv[argc++] = (char *)updates[idx].val;
+  }
+  helper_argv[argc] = NULL;
+
+  // Same silencing as the fork path: nothing may reach glexec's stdout/err.
+  if ((rc = posix_spawn_file_actions_init(&actions))) {
+    limited_log(0, "%s: Failed to initialize spawn actions: %d %s\n", logstr, rc, strerror(rc));
+    goto spawn_done;
+  }
+  if ((rc = posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0)) ||
+      (rc = posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0))) {
+    limited_log(0, "%s: Failed to set up spawn actions: %d %s\n", logstr, rc, strerror(rc));
+    goto spawn_actions_done;
+  }
+  if ((rc = posix_spawn(&helper_pid, CONDOR_UPDATE_HELPER_PATH, &actions, NULL, helper_argv, helper_env))) {
+    limited_log(0, "%s: Failed to spawn %s: %d %s\n", logstr, CONDOR_UPDATE_HELPER_PATH, rc, strerror(rc));
+    helper_pid = -1;
+  }
+
+spawn_actions_done:
+  posix_spawn_file_actions_destroy(&actions);
+spawn_done:
+  close(status_fd);
+  free(helper_argv);
+  return helper_pid;
+}
+
+/*
+ * Wait for the child's result on the status pipe.  Returns 1 and sets *code
+ * if the child reported an error, 0 if the pipe was closed without one (the
+ * child daemonized or exec'd), or -1 if the deadline (in stats_now() time;
+ * 0 for none) passed first or the pipe failed.
+ */
+static int read_child_result(int fd, uint64_t deadline, int *code) {
+  char buf[TIME_BUFFER_SIZE];
+  size_t len = 0;
+  struct pollfd pfd;
+  ssize_t bytes;
+  int rc, wait_ms;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (1) {
+    wait_ms = -1;
+    if (deadline) {
+      uint64_t now = stats_now();
+      if (now >= deadline) {
+        return -1;
+      }
+      wait_ms = (deadline - now + 999) / 1000;
+    }
+    if ((rc = poll(&pfd, 1, wait_ms)) == -1) {
+      if (errno == EINTR) continue;
+      limited_log(0, "%s: Failed to poll the child's status pipe: %d %s\n", logstr, errno, strerror(errno));
+      return -1;
+    } else if (rc == 0) {
+      continue; // The deadline check above ends the loop.
+    }
+    if ((bytes = read(fd, buf + len, sizeof(buf) - 1 - len)) == -1) {
+      if (errno == EINTR) continue;
+      limited_log(0, "%s: Failed to read the child's status pipe: %d %s\n", logstr, errno, strerror(errno));
+      return -1;
+    }
+    len += bytes;
+    if ((bytes == 0) || (len == sizeof(buf) - 1)) {
+      break;
+    }
+  }
+  buf[len] = '\0';
+  return (sscanf(buf, "%d", code) == 1) ? 1 : 0;
+}
+
+/*
+ * waitpid() that gives up at the deadline (0 for none).  Returns 0 once the
+ * child is reaped, -1 otherwise.
+ */
+static int wait_child(pid_t pid, int *status, uint64_t deadline) {
+  struct timespec delay = {0, 100000};
+  pid_t rc;
+
+  while (1) {
+    if ((rc = waitpid(pid, status, deadline ? WNOHANG : 0)) == pid) {
+      return 0;
+    } else if ((rc == -1) && (errno != EINTR)) {
+      limited_log(0, "%s: Failed to reap child %d: %d %s\n", logstr, pid, errno, strerror(errno));
+      return -1;
+    }
+    if (deadline && (stats_now() >= deadline)) {
+      return -1;
+    }
+    // The child normally exits right after daemonizing; back off gently.
+    nanosleep(&delay, NULL);
+    if (delay.tv_nsec < 10000000) {
+      delay.tv_nsec *= 2;
+    }
+  }
+}
+
+/*
+ * Push a batch of ClassAd attributes to the starter.  All of the updates are
+ * sent from a single privilege-dropped child, so the cost of discovering the
+ * starter, forking and switching to the user is paid once per batch.
+ */
+int update_starter_batch(const classad_update_t *updates, size_t count, uint64_t deadline) {
   int fork_pid;
   int fd_flags;
   int rc, exit_code;
   int status;
   int p2c[2];
   int result = 0;
-  FILE * fh;
+  size_t idx;
+  uid_t uid;
+  gid_t gid;
+  uint64_t start;
+
+  if (count == 0) {
+    return 0;
+  }
+  for (idx = 0; idx < count; idx++) {
+    if (updates[idx].attr == NULL) {
+      limited_log(0, "%s: Internal error - passed a NULL attribute\n", logstr);
+      return 1;
+    }
+    if (updates[idx].val == NULL) {
+      limited_log(0, "%s: Internal error - passed a NULL value for %s\n", logstr, updates[idx].attr);
+      return 1;
+    }
+  }
 
   pid_t pid = getpid();
 
   char * scratch_dir = findCondorScratch(pid);
   if (!scratch_dir) {
-    lcmaps_log(0, "%s: Environment error - unable to determine the starter's scratch directory\n", logstr);
+    limited_log(0, "%s: Environment error - unable to determine the starter's scratch directory\n", logstr);
     return 1;
   }
 
-  if (attr == NULL) {
-    lcmaps_log(0, "%s: Internal error - passed a NULL attribute\n", attr);
+  if (getParentIDs(pid, &uid, &gid)) {
+    limited_log(0, "%s: Unable to determine target user UID/GID\n", logstr);
     result = 1;
     goto finalize;
   }
-  if (val == NULL) {
-    lcmaps_log(0, "%s: Internal error - passed a NULL value\n", attr);
+
+  if (deadline && (stats_now() >= deadline)) {
+    limited_log(0, "%s: Time budget of %ld ms spent before the update; deferring %lu attributes.\n", logstr, timeout_ms, (unsigned long)count);
     result = 1;
     goto finalize;
   }
 
   if (pipe(p2c) < 0) {
-    lcmaps_log(0, "%s: Failed to create an internal pipe: %d %s\n", logstr, errno, strerror(errno));
+    limited_log(0, "%s: Failed to create an internal pipe: %d %s\n", logstr, errno, strerror(errno));
     result = errno;
     goto finalize;
   }
   if ((fd_flags = fcntl(p2c[1], F_GETFD, NULL)) == -1) {
-    lcmaps_log(0, "%s: Failed to get fd flags: %d %s\n", logstr, errno, strerror(errno));
+    limited_log(0, "%s: Failed to get fd flags: %d %s\n", logstr, errno, strerror(errno));
     result = errno;
     goto finalize;
   }
   if (fcntl(p2c[1], F_SETFD, fd_flags | FD_CLOEXEC) == -1) {
-    lcmaps_log(0, "%s: Failed to set new fd flags: %d %s\n", logstr, errno, strerror(errno));
+    limited_log(0, "%s: Failed to set new fd flags: %d %s\n", logstr, errno, strerror(errno));
     result = errno;
     goto finalize;
   }
 
-  fork_pid = fork();
+  start = stats_now();
+  fork_pid = -1;
+  if (spawn_mode == SPAWN_MODE_HELPER) {
+    if ((fork_pid = spawn_update_helper(updates, count, p2c[1], scratch_dir, uid, gid)) == -1) {
+      limited_log(1, "%s: Falling back to fork for the ClassAd update.\n", logstr);
+    }
+  }
   if (fork_pid == -1) {
-    lcmaps_log(0, "%s: Failed to fork a new child process: %d %s\n", logstr, errno, strerror(errno));
-    close(p2c[0]); close(p2c[1]);
-    result = errno;
-    goto finalize;
-  } else if (fork_pid == 0) { // Child
-    close(p2c[0]);
-    update_starter_child(attr, val, p2c[1], scratch_dir, pid);
-    // Does not return.  Just in case:
-    _exit(1);
+    fork_pid = fork();
+    if (fork_pid == -1) {
+      limited_log(0, "%s: Failed to fork a new child process: %d %s\n", logstr, errno, strerror(errno));
+      close(p2c[0]); close(p2c[1]);
+      result = errno;
+      goto finalize;
+    } else if (fork_pid == 0) { // Child
+      close(p2c[0]);
+      update_starter_child(updates, count, p2c[1], scratch_dir, uid, gid, &update_options);
+      // Does not return.  Just in case:
+      _exit(1);
+    }
   }
+  stats_record(STATS_SPAWN, start);
+  stats_count(STATS_FORKS, 1);
 
+  start = stats_now();
   close(p2c[1]);
-  if ((fh = fdopen(p2c[0], "r")) == NULL) {
-    lcmaps_log(0, "%s: Failed to reopen file descriptor as file handle: %d %s", logstr, errno, strerror(errno));
-    close(p2c[0]);
-    result = errno;
-    goto finalize;
-  }
-  rc = fscanf(fh, "%d", &exit_code);
+  rc = read_child_result(p2c[0], deadline, &exit_code);
   close(p2c[0]);
 
-  if (rc != 1) {
-    // exec succeeded!  Let's check the exit status
+  if (rc == 0) {
+    // The child daemonized without reporting an error.  Let's check the exit status
     // Note that we just check to see if condor_chirp daemonized, not whether
     // it succeeded.  The problem is that the starter will block on us, and
     // we block on condor_starter, and condor_starter blocks on the single-threaded starter.
     // See the issue?
-    waitpid(fork_pid, &status, 0);
-    if (WIFEXITED(status)) {
+    if (wait_child(fork_pid, &status, deadline)) {
+      rc = -1;
+    } else if (WIFEXITED(status)) {
       if (!(exit_code = WEXITSTATUS(status))) {
-        lcmaps_log(2, "%s: ClassAd update %s=%s successful\n", logstr, attr, val);
+        for (idx = 0; idx < count; idx++) {
+          limited_log(2, "%s: ClassAd update %s=%s successful\n", logstr, updates[idx].attr, updates[idx].val);
+        }
         result = 0;
       } else {
-        lcmaps_log(0, "%s: ClassAd update %s=%s failed.\n", logstr, attr, val);
+        limited_log(0, "%s: ClassAd update of %lu attributes failed.\n", logstr, (unsigned long)count);
         result = 1;
       }
     } else {
-      lcmaps_log(0, "%s: Unrecognized condor_chirp status: %d\n", logstr, status);
+      limited_log(0, "%s: Unrecognized condor_chirp status: %d\n", logstr, status);
       result = 1;
     }
-  } else {
-    lcmaps_log(0, "%s: Update of %s returned error before exec: %d\n", logstr, attr, exit_code);
+  } else if (rc == 1) {
+    limited_log(0, "%s: Update of %lu attributes returned error before exec: %d\n", logstr, (unsigned long)count, exit_code);
+    wait_child(fork_pid, &status, 0);
     result = 1;
   }
+  if (rc == -1) {
+    // Out of time (or the pipe broke): the child may be stuck on NSS or a
+    // wedged scratch filesystem.  Don't let it hold up glexec.
+    limited_log(0, "%s: Child %d did not finish within %ld ms; killing it and deferring %lu attributes.\n", logstr, fork_pid, timeout_ms, (unsigned long)count);
+    kill(fork_pid, SIGKILL);
+    if (wait_child(fork_pid, &status, stats_now() + KILL_GRACE_US)) {
+      limited_log(0, "%s: Unable to reap child %d.\n", logstr, fork_pid);
+    }
+    result = 1;
+  }
+  stats_record(STATS_CHILD, start);
 
 finalize:
 
@@ -293,19 +498,253 @@ finalize:
 
 }
 
+int update_starter(const char * attr, const char * val) {
+  classad_update_t update = {attr, val};
+  return update_starter_batch(&update, 1, 0);
+}
+
 
 /******************************************************************************
 Function:   plugin_initialize
 Description:
-    Initialize plugin; a no-op, but required by LCMAPS
+    Initialize plugin; parses the plugin options.
 Parameters:
     argc, argv
     argv[0]: the name of the plugin
+    -discovery lazy|full|refresh: walk only the ancestors of glexec (default)
+        or scan every process in /proc to find the starter.  refresh walks
+        the ancestors on every mapping, re-reading only processes whose
+        start time changed; for LCMAPS hosts that map more than once.
+    -proc-root path: location of the proc filesystem (default /proc).
+    -cgroup on|off: find the starter through the job's cgroup, if HTCondor
+        put it in one, before falling back to the process tree (default on).
+    -cgroup-root path: where the cgroup hierarchies are mounted
+        (default /sys/fs/cgroup).
+    -discovery-cache path: share discovery results between invocations on
+        the node through a root-owned file, e.g. under /dev/shm (default:
+        none).  Entries are checked against the start time of the starter.
+    -discovery-daemon path: ask condor_discovery_daemon, listening at the
+        Unix socket path, before looking at /proc (default: none).  If it
+        is not running or does not answer, discovery carries on as above.
+    -username-arg name: LCMAPS run argument (char *) holding the name of
+        the account, e.g. requested_username; used for glexec_user when
+        the user cache has no entry for the mapped UID, instead of looking
+        it up (default: none).  The argument is not checked against the
+        UID, so it must name the mapped account: with pool accounts, the
+        requested name is not the one glexec runs as.
+    -user-cache path: remember user names looked up in NSS in a root-owned
+        file shared by every invocation on the node, e.g. under /dev/shm
+        (default: none).
+    -user-cache-ttl N: how long an entry of the user cache is used, in
+        seconds (default 600).
+    -scan-threads N: threads used when /proc has to be scanned in full
+        (default 1; 0 means one per CPU).
+    -scan-uring on|off: in a full scan, read the status files in batches
+        through io_uring where the kernel allows it (default on).
+    -backend native-chirp|exec-chirp|file-drop: where the updates go.
+        native-chirp talks to the starter with the built-in Chirp client,
+        falling back to condor_chirp (default); exec-chirp always execs
+        condor_chirp; file-drop writes the attributes, one "attr = value"
+        line each, to a file in the job's scratch directory and renames it
+        into place, for sites that harvest it on the starter side.  file-drop
+        needs neither exec nor network, and always writes every attribute.
+    -chirp native|exec: the same as -backend native-chirp|exec-chirp.
+    -drop-file name: name of the file written by the file-drop backend
+        (default .lcmaps_update.ad).
+    -suppress on|off: remember, in a file next to the job's chirp config, the
+        values last sent for the job and skip attributes that have not
+        changed since (default off).
+    -time-interval N: with -suppress on, send glexec_time at most every N
+        seconds (default 0: every time).
+    -history on|off: keep running totals for the job in a file next to its
+        chirp config, and send glexec_count, glexec_distinct_users and
+        glexec_first_time with the other attributes (default off).
+    -timeout ms: time budget for the plugin (default 0: none).  A child that
+        has not finished the update in time is killed, and the update is
+        skipped rather than failing the mapping.
+    -stats-level N: lcmaps_log level of the per-mapping timing summary
+        (default 2).
+    -stats-file path: also accumulate counters and latency histograms for
+        every mapping in path (default: none).
+    -spawn fork|helper: fork this process to drop privileges (default), or
+        posix_spawn condor_update_helper, which does not slow down as the
+        calling process grows.  Falls back to fork if the helper cannot run.
+    -log-rate N: log at most N messages per second on average (default
+        10; 0: no limit).  Debug messages are not limited.
+    -log-burst N: messages that may be logged at once (default 50; must be
+        positive).
+    -log-limit-file path: share the log rate limit between every invocation
+        on the node through a root-owned file, e.g. under /dev/shm (default:
+        none; each invocation has a limit of its own).
 Returns:
     LCMAPS_MOD_SUCCESS : success
+    LCMAPS_MOD_FAIL    : unrecognized or malformed option
 ******************************************************************************/
 int plugin_initialize(int argc, char **argv)
 {
+  int idx;
+
+  for (idx = 1; idx < argc; idx++) {
+    if ((strcasecmp(argv[idx], "-discovery") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "lazy") == 0) {
+        setCondorDiscoveryMode(CONDOR_DISCOVERY_LAZY);
+      } else if (strcasecmp(argv[idx], "full") == 0) {
+        setCondorDiscoveryMode(CONDOR_DISCOVERY_FULL);
+      } else if (strcasecmp(argv[idx], "refresh") == 0) {
+        setCondorDiscoveryMode(CONDOR_DISCOVERY_REFRESH);
+      } else {
+        limited_log(0, "%s: Unknown discovery mode: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-proc-root") == 0) && (idx + 1 < argc)) {
+      if (setCondorProcRoot(argv[++idx])) {
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-cgroup") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "on") == 0) {
+        setCondorCgroupDiscovery(1);
+      } else if (strcasecmp(argv[idx], "off") == 0) {
+        setCondorCgroupDiscovery(0);
+      } else {
+        limited_log(0, "%s: Unknown cgroup setting: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-cgroup-root") == 0) && (idx + 1 < argc)) {
+      if (setCondorCgroupRoot(argv[++idx])) {
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-discovery-cache") == 0) && (idx + 1 < argc)) {
+      // A cache that cannot be used only costs speed; do not fail the mapping.
+      setCondorDiscoveryCache(argv[++idx]);
+    } else if ((strcasecmp(argv[idx], "-discovery-daemon") == 0) && (idx + 1 < argc)) {
+      if (setCondorDiscoveryDaemon(argv[++idx])) {
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-username-arg") == 0) && (idx + 1 < argc)) {
+      if (snprintf(username_arg, sizeof(username_arg), "%s", argv[++idx]) >= (int)sizeof(username_arg)) {
+        limited_log(0, "%s: Argument name is too long: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-user-cache") == 0) && (idx + 1 < argc)) {
+      // As with the discovery cache, an unusable cache only costs speed.
+      user_cache_open(argv[++idx]);
+    } else if ((strcasecmp(argv[idx], "-user-cache-ttl") == 0) && (idx + 1 < argc)) {
+      user_cache_ttl = atol(argv[++idx]);
+    } else if ((strcasecmp(argv[idx], "-scan-threads") == 0) && (idx + 1 < argc)) {
+      setCondorScanThreads(atoi(argv[++idx]));
+    } else if ((strcasecmp(argv[idx], "-scan-uring") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "on") == 0) {
+        setCondorScanUring(1);
+      } else if (strcasecmp(argv[idx], "off") == 0) {
+        setCondorScanUring(0);
+      } else {
+        limited_log(0, "%s: Unknown scan-uring setting: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-backend") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "native-chirp") == 0) {
+        update_options.backend = UPDATE_BACKEND_NATIVE_CHIRP;
+      } else if (strcasecmp(argv[idx], "exec-chirp") == 0) {
+        update_options.backend = UPDATE_BACKEND_EXEC_CHIRP;
+      } else if (strcasecmp(argv[idx], "file-drop") == 0) {
+        update_options.backend = UPDATE_BACKEND_FILE_DROP;
+      } else {
+        limited_log(0, "%s: Unknown update backend: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-chirp") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "native") == 0) {
+        update_options.backend = UPDATE_BACKEND_NATIVE_CHIRP;
+      } else if (strcasecmp(argv[idx], "exec") == 0) {
+        update_options.backend = UPDATE_BACKEND_EXEC_CHIRP;
+      } else {
+        limited_log(0, "%s: Unknown chirp mode: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-drop-file") == 0) && (idx + 1 < argc)) {
+      idx++;
+      // A plain name: the file goes in the scratch directory and nowhere else.
+      if (!argv[idx][0] || strchr(argv[idx], '/') || (strlen(argv[idx]) >= NAME_MAX)) {
+        limited_log(0, "%s: Invalid drop file name: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+      strcpy(drop_name, argv[idx]);
+      update_options.drop_name = drop_name;
+    } else if ((strcasecmp(argv[idx], "-suppress") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "on") == 0) {
+        update_options.suppress = 1;
+      } else if (strcasecmp(argv[idx], "off") == 0) {
+        update_options.suppress = 0;
+      } else {
+        limited_log(0, "%s: Unknown suppress setting: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-history") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "on") == 0) {
+        update_options.history_attr = CLASSAD_GLEXEC_USER;
+      } else if (strcasecmp(argv[idx], "off") == 0) {
+        update_options.history_attr = NULL;
+      } else {
+        limited_log(0, "%s: Unknown history setting: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-time-interval") == 0) && (idx + 1 < argc)) {
+      // Checked as condor_update_helper does, so both spawn modes accept the
+      // same settings.
+      char *end;
+      update_options.throttle_interval = strtol(argv[++idx], &end, 10);
+      if ((*argv[idx] == '\0') || (*end != '\0') || (update_options.throttle_interval < 0)) {
+        limited_log(0, "%s: Invalid time interval: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-timeout") == 0) && (idx + 1 < argc)) {
+      if ((timeout_ms = atol(argv[++idx])) < 0) {
+        limited_log(0, "%s: Invalid timeout: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-stats-level") == 0) && (idx + 1 < argc)) {
+      stats_level = atoi(argv[++idx]);
+    } else if ((strcasecmp(argv[idx], "-stats-file") == 0) && (idx + 1 < argc)) {
+      if (snprintf(stats_file, PATH_MAX, "%s", argv[++idx]) >= PATH_MAX) {
+        limited_log(0, "%s: Statistics file name is too long: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-spawn") == 0) && (idx + 1 < argc)) {
+      idx++;
+      if (strcasecmp(argv[idx], "fork") == 0) {
+        spawn_mode = SPAWN_MODE_FORK;
+      } else if (strcasecmp(argv[idx], "helper") == 0) {
+        spawn_mode = SPAWN_MODE_HELPER;
+      } else {
+        limited_log(0, "%s: Unknown spawn mode: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-log-rate") == 0) && (idx + 1 < argc)) {
+      if ((log_rate = atoi(argv[++idx])) < 0) {
+        limited_log(0, "%s: Invalid log rate: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-log-burst") == 0) && (idx + 1 < argc)) {
+      if ((log_burst = atoi(argv[++idx])) <= 0) {
+        limited_log(0, "%s: Invalid log burst: %s\n", logstr, argv[idx]);
+        return LCMAPS_MOD_FAIL;
+      }
+    } else if ((strcasecmp(argv[idx], "-log-limit-file") == 0) && (idx + 1 < argc)) {
+      // Without the file, each invocation is still limited on its own.
+      log_limit_open(argv[++idx]);
+    } else {
+      limited_log(0, "%s: Unknown or incomplete plugin option: %s\n", logstr, argv[idx]);
+      return LCMAPS_MOD_FAIL;
+    }
+  }
+  log_limit_set(log_rate, log_burst);
   return LCMAPS_MOD_SUCCESS;
 }
 
@@ -324,9 +763,16 @@ int plugin_introspect(int *argc, lcmaps_argument_t **argv)
   char *logstr = "\tlcmaps_plugins_condor_update-plugin_introspect()";
   static lcmaps_argument_t argList[] = {
     { "user_dn"        , "char *"                ,  1, NULL},
+    {NULL        ,  NULL    , -1, NULL}, // The -username-arg argument, if any.
     {NULL        ,  NULL    , -1, NULL}
   };
 
+  if (username_arg[0]) {
+    argList[1].argName = username_arg;
+    argList[1].argType = "char *";
+    argList[1].argInOut = 1;
+  }
+
   lcmaps_log_debug(2, "%s: introspecting\n", logstr);
 
   *argv = argList;
@@ -356,59 +802,84 @@ Returns:
 int plugin_run(int argc, lcmaps_argument_t *argv)
 {
   uid_t uid;
-  char * username;
+  char username[USERNAME_BUFFER_SIZE];
   char **dn_array, *dn;
   char time_string[TIME_BUFFER_SIZE];
   time_t curtime;
   size_t len;
+  char * quoted_username = NULL, * quoted_dn = NULL;
+  classad_update_t updates[3];
+  size_t update_count = 0;
+  int result = LCMAPS_MOD_FAIL;
+  uint64_t run_start = stats_now(), start;
+
+  stats_reset();
 
   // Update the user name.
-  get_user_ids(&uid, NULL, &username);
+  start = stats_now();
+  if (get_user_ids(argc, argv, &uid, NULL, username, sizeof(username))) {
+    goto condor_update_failure;
+  }
+  stats_record(STATS_USER_IDS, start);
   size_t username_len = strlen(username);
-  char * quoted_username = (char *)malloc(username_len + 2 + 1);
+  quoted_username = (char *)malloc(username_len + 2 + 1);
   if (quoted_username == NULL) {
-    lcmaps_log(0, "%s: Malloc failed for quoted username.\n", logstr);
+    limited_log(0, "%s: Malloc failed for quoted username.\n", logstr);
     goto condor_update_failure;
   }
   snprintf(quoted_username, username_len + 3, "\"%s\"", username);
 
-  update_starter(CLASSAD_GLEXEC_USER, quoted_username);
+  updates[update_count].attr = CLASSAD_GLEXEC_USER;
+  updates[update_count++].val = quoted_username;
 
   // Update the DN.
   lcmaps_log_debug(2, "%s: Acquiring information from LCMAPS framework\n", logstr);
   dn_array = (char **)lcmaps_getArgValue("user_dn", "char *",argc, argv);
   if ((dn_array == NULL) || ((dn = *dn_array) == NULL)) {
-    lcmaps_log(0, "%s: value of user_dn is empty. No user DN found by the framework in the proxy chain.\n", logstr);
+    limited_log(0, "%s: value of user_dn is empty. No user DN found by the framework in the proxy chain.\n", logstr);
     goto condor_update_failure;
   } else {
     lcmaps_log_debug(5, "%s: user_dn = %s\n", logstr, dn);
   }
   size_t dn_len = strlen(dn);
-  char * quoted_dn = (char *)malloc(dn_len + 2 + 1);
+  quoted_dn = (char *)malloc(dn_len + 2 + 1);
   if (quoted_dn == NULL) {
-    lcmaps_log(0, "%s: Malloc failed for quoted DN.\n", logstr);
+    limited_log(0, "%s: Malloc failed for quoted DN.\n", logstr);
     goto condor_update_failure;
   }
   snprintf(quoted_dn, dn_len + 3, "\"%s\"", dn);
 
-  update_starter(CLASSAD_GLEXEC_DN, quoted_dn);
+  updates[update_count].attr = CLASSAD_GLEXEC_DN;
+  updates[update_count++].val = quoted_dn;
 
   // Update the invocation time.
   lcmaps_log_debug(2, "%s: Logging time of invocation\n", logstr);
   curtime = time(NULL);
   if ((len = snprintf(time_string, TIME_BUFFER_SIZE, "%ld", curtime)) >= TIME_BUFFER_SIZE) {
-    lcmaps_log(0, "%s: Unexpected failure in converting time to string.\n", logstr);
+    limited_log(0, "%s: Unexpected failure in converting time to string.\n", logstr);
     goto condor_update_failure;
   }
-  update_starter(CLASSAD_GLEXEC_TIME, time_string);
+  updates[update_count].attr = CLASSAD_GLEXEC_TIME;
+  updates[update_count++].val = time_string;
 
-  return LCMAPS_MOD_SUCCESS;
+  // A failed ClassAd update is logged but does not fail the mapping.
+  update_starter_batch(updates, update_count, timeout_ms ? run_start + timeout_ms * 1000 : 0);
 
+  result = LCMAPS_MOD_SUCCESS;
+  goto condor_update_done;
 
 condor_update_failure:
   lcmaps_log_time(0, "%s: monitor process launch failed\n", logstr);
 
-  return LCMAPS_MOD_FAIL;
+condor_update_done:
+  free(quoted_username);
+  free(quoted_dn);
+  stats_record(STATS_TOTAL, run_start);
+  stats_log(stats_level);
+  if (stats_file[0]) {
+    stats_save(stats_file);
+  }
+  return result;
 }
 
 int plugin_verify(int argc, lcmaps_argument_t * argv)
@@ -419,7 +890,8 @@ int plugin_verify(int argc, lcmaps_argument_t * argv)
 /******************************************************************************
 Function:   plugin_terminate
 Description:
-    Terminate plugin.  Boilerplate - doesn't do anything
+    Terminate plugin; frees the cached process snapshot and unmaps the
+    discovery cache, the user cache and the shared log limit.
 Parameters:
 
 Returns:
@@ -427,5 +899,10 @@ Returns:
 ******************************************************************************/
 int plugin_terminate()
 {
+  freeCondorAncestry();
+  setCondorDiscoveryCache(NULL);
+  setCondorDiscoveryDaemon(NULL);
+  user_cache_close();
+  log_limit_close();
   return LCMAPS_MOD_SUCCESS;
 }
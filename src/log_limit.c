@@ -0,0 +1,113 @@
+/*
+ * lcmaps-condor-update
+ * Rate limit for lcmaps_log; see log_limit.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#include "lcmaps/lcmaps_log.h"
+
+#include "discovery_cache.h"
+#include "log_limit.h"
+
+static const char * logstr = "lcmaps-condor-update";
+
+#define LOG_LIMIT_MAGIC 0x4c434c01U
+// Longer messages are truncated.
+#define LOG_LIMIT_MSG 2048
+
+// The bucket is kept as the time at which it will be full again (the
+// generic cell rate algorithm), so taking a token is a single compare and
+// swap that works across processes sharing the file.
+typedef struct {
+  volatile uint32_t magic;
+  uint32_t reserved;
+  volatile uint64_t full_at; // Monotonic clock, in microseconds.
+  volatile uint64_t dropped; // Messages not logged since the last one that was.
+} log_bucket_t;
+
+static log_bucket_t local_bucket;
+static log_bucket_t *bucket = &local_bucket;
+static unsigned limit_rate = LOG_LIMIT_RATE;
+static unsigned limit_burst = LOG_LIMIT_BURST;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void log_limit_set(unsigned rate, unsigned burst) {
+  limit_rate = rate;
+  limit_burst = burst ? burst : 1;
+}
+
+int log_limit_open(const char *path) {
+  log_bucket_t *shared;
+  log_limit_close();
+  if ((shared = (log_bucket_t *)cache_file_map(path, sizeof(log_bucket_t), LOG_LIMIT_MAGIC, "log limit file")) == NULL) {
+    return -1;
+  }
+  bucket = shared;
+  return 0;
+}
+
+void log_limit_close(void) {
+  if (bucket != &local_bucket) {
+    munmap(bucket, sizeof(log_bucket_t));
+    bucket = &local_bucket;
+  }
+}
+
+static int log_limit_take(void) {
+  uint64_t now, interval, full_at, next, seen;
+
+  if (!limit_rate) {
+    return 1;
+  }
+  interval = 1000000 / limit_rate;
+  now = now_us();
+  full_at = bucket->full_at;
+  for (;;) {
+    // Later than any bucket could be full: written before a reboot, or by an
+    // invocation with a larger burst.  Start over.
+    if ((full_at < now) || (full_at > now + (uint64_t)limit_burst * interval)) {
+      next = now + interval;
+    } else {
+      next = full_at + interval;
+    }
+    if (next > now + (uint64_t)limit_burst * interval) {
+      return 0;
+    }
+    if ((seen = __sync_val_compare_and_swap(&bucket->full_at, full_at, next)) == full_at) {
+      return 1;
+    }
+    full_at = seen;
+  }
+}
+
+int limited_log(int prty, const char *fmt, ...) {
+  char msg[LOG_LIMIT_MSG];
+  uint64_t dropped;
+  va_list ap;
+
+  if (!log_limit_take()) {
+    __sync_fetch_and_add(&bucket->dropped, 1);
+    return 0;
+  }
+  if ((dropped = __sync_lock_test_and_set(&bucket->dropped, 0))) {
+    lcmaps_log(prty, "%s: %llu messages were dropped by the log rate limit\n", logstr, (unsigned long long)dropped);
+  }
+  va_start(ap, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+  va_end(ap);
+  return lcmaps_log(prty, "%s", msg);
+}
@@ -0,0 +1,39 @@
+#ifndef __LOG_LIMIT_H
+#define __LOG_LIMIT_H
+
+/*
+ * Rate limit for the plugin's lcmaps_log messages, so that a burst of glexec
+ * invocations that all run into the same problem cannot swamp syslog.  A
+ * message is logged if the token bucket (burst messages, refilled at rate
+ * per second) has room.  The bucket belongs to this process unless a file is
+ * given, in which case every invocation on the node draws from the same one.
+ * Dropped messages are counted, and the next message that gets through is
+ * preceded by the count.  Debug messages (lcmaps_log_debug) are not limited.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_LIMIT_RATE 10
+#define LOG_LIMIT_BURST 50
+
+/* rate messages per second on average and at most burst at once; a rate of
+   0 turns the limit off. */
+void log_limit_set(unsigned rate, unsigned burst);
+
+/* Share the bucket through the file at path, created if needed and checked
+   like the discovery cache.  Returns 0 on success; otherwise the process
+   keeps a bucket of its own. */
+int log_limit_open(const char *path);
+
+void log_limit_close(void);
+
+/* lcmaps_log, unless over the limit. */
+int limited_log(int prty, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
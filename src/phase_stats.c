@@ -0,0 +1,233 @@
+
+/*
+ * lcmaps-condor-update
+ * Phase timings and counters; see phase_stats.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include "lcmaps/lcmaps_log.h"
+
+#include "phase_stats.h"
+#include "log_limit.h"
+
+static const char * logstr = "lcmaps-condor-update";
+
+// Latency histograms use power-of-two buckets: [0,2), [2,4), [4,8) ...
+// microseconds; the last bucket also takes everything above 2^24 us (~17s).
+#define STATS_BUCKETS 24
+#define STATS_FILE_SIZE 8192
+// A save waits at most this many milliseconds for the lock, one at a time.
+#define STATS_LOCK_TRIES 10
+
+static const char * const phase_names[STATS_PHASE_COUNT] = {
+  "user_ids", "discovery", "environ", "parent_ids", "spawn", "child", "total"
+};
+static const char * const counter_names[STATS_COUNTER_COUNT] = {
+  "processes", "bytes_read", "forks", "cache_hits", "scan_syscalls",
+  "user_cache_hits", "daemon_hits"
+};
+
+static uint64_t phase_us[STATS_PHASE_COUNT];
+static int phase_seen[STATS_PHASE_COUNT];
+static uint64_t counters[STATS_COUNTER_COUNT];
+// Saves skipped because the file was locked, for the next save that is not.
+static uint64_t skipped_saves;
+
+typedef struct {
+  uint64_t invocations;
+  uint64_t skipped;
+  uint64_t counters[STATS_COUNTER_COUNT];
+  uint64_t count[STATS_PHASE_COUNT];
+  uint64_t total_us[STATS_PHASE_COUNT];
+  uint64_t histogram[STATS_PHASE_COUNT][STATS_BUCKETS];
+} saved_stats_t;
+
+uint64_t stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void stats_reset(void) {
+  memset(phase_us, 0, sizeof(phase_us));
+  memset(phase_seen, 0, sizeof(phase_seen));
+  memset(counters, 0, sizeof(counters));
+}
+
+void stats_record(int phase, uint64_t start) {
+  phase_us[phase] += stats_now() - start;
+  phase_seen[phase] = 1;
+}
+
+void stats_count(int counter, uint64_t value) {
+  __sync_fetch_and_add(&counters[counter], value);
+}
+
+uint64_t stats_counter(int counter) {
+  return __sync_fetch_and_add(&counters[counter], 0);
+}
+
+void stats_log(int level) {
+  char line[512];
+  size_t len = 0;
+  int idx;
+
+  for (idx = 0; idx < STATS_PHASE_COUNT && len < sizeof(line); idx++) {
+    if (phase_seen[idx]) {
+      len += snprintf(line + len, sizeof(line) - len, " %s=%llu", phase_names[idx], (unsigned long long)phase_us[idx]);
+    }
+  }
+  for (idx = 0; idx < STATS_COUNTER_COUNT && len < sizeof(line); idx++) {
+    len += snprintf(line + len, sizeof(line) - len, " %s=%llu", counter_names[idx], (unsigned long long)counters[idx]);
+  }
+  // Not rate limited: during a storm of failures, this line says where the
+  // time went.
+  lcmaps_log(level, "%s: Timing (us):%s\n", logstr, line);
+}
+
+static int bucket(uint64_t us) {
+  int idx = 0;
+  while ((us >>= 1) && (idx < STATS_BUCKETS - 1)) {
+    idx++;
+  }
+  return idx;
+}
+
+/* Lines are "name value..."; unknown names and short lines are ignored, so
+   the format can grow without breaking older files. */
+static void parse_stats(char *buf, saved_stats_t *saved) {
+  char *next = buf, *line;
+  uint64_t values[2 + STATS_BUCKETS];
+  int count, idx;
+
+  while ((line = strsep(&next, "\n"))) {
+    char *name = strsep(&line, " ");
+    if (!line || (*name == '#')) {
+      continue;
+    }
+    for (count = 0; count < 2 + STATS_BUCKETS; count++) {
+      char *end;
+      values[count] = strtoull(line, &end, 10);
+      if (end == line) break;
+      line = end;
+    }
+    if (count == 0) {
+      continue;
+    }
+    if (strcmp(name, "invocations") == 0) {
+      saved->invocations = values[0];
+    }
+    if (strcmp(name, "skipped_saves") == 0) {
+      saved->skipped = values[0];
+    }
+    for (idx = 0; idx < STATS_COUNTER_COUNT; idx++) {
+      if (strcmp(name, counter_names[idx]) == 0) {
+        saved->counters[idx] = values[0];
+      }
+    }
+    for (idx = 0; idx < STATS_PHASE_COUNT; idx++) {
+      if ((strcmp(name, phase_names[idx]) == 0) && (count == 2 + STATS_BUCKETS)) {
+        saved->count[idx] = values[0];
+        saved->total_us[idx] = values[1];
+        memcpy(saved->histogram[idx], values + 2, sizeof(saved->histogram[idx]));
+      }
+    }
+  }
+}
+
+static size_t format_stats(const saved_stats_t *saved, char *buf, size_t size) {
+  size_t len;
+  int idx, bin;
+
+  len = snprintf(buf, size,
+                 "# lcmaps-condor-update statistics.  Latency lines: count, total us, then\n"
+                 "# counts for [0,2) [2,4) [4,8) ... us; the last bucket is open-ended.\n"
+                 "invocations %llu\n"
+                 "skipped_saves %llu\n", (unsigned long long)saved->invocations, (unsigned long long)saved->skipped);
+  for (idx = 0; idx < STATS_COUNTER_COUNT && len < size; idx++) {
+    len += snprintf(buf + len, size - len, "%s %llu\n", counter_names[idx], (unsigned long long)saved->counters[idx]);
+  }
+  for (idx = 0; idx < STATS_PHASE_COUNT && len < size; idx++) {
+    len += snprintf(buf + len, size - len, "%s %llu %llu", phase_names[idx],
+                    (unsigned long long)saved->count[idx], (unsigned long long)saved->total_us[idx]);
+    for (bin = 0; bin < STATS_BUCKETS && len < size; bin++) {
+      len += snprintf(buf + len, size - len, " %llu", (unsigned long long)saved->histogram[idx][bin]);
+    }
+    if (len < size) {
+      len += snprintf(buf + len, size - len, "\n");
+    }
+  }
+  return len;
+}
+
+int stats_save(const char *path) {
+  char buf[STATS_FILE_SIZE];
+  saved_stats_t saved;
+  ssize_t bytes;
+  size_t len;
+  int fd, idx, tries = 0, result = 0, locked;
+
+  if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644)) == -1) {
+    limited_log(0, "%s: Unable to open statistics file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    return -1;
+  }
+  // Do not block: the mapping's time budget is already spent, and a stuck
+  // holder of the lock must not stall glexec.  Other saves hold it only
+  // briefly, so a few retries ride out a burst.
+  while (((locked = flock(fd, LOCK_EX | LOCK_NB)) == -1) && (errno == EWOULDBLOCK) && (++tries < STATS_LOCK_TRIES)) {
+    usleep(1000);
+  }
+  if (locked == -1) {
+    if (errno == EWOULDBLOCK) {
+      lcmaps_log_debug(2, "%s: Statistics file %s is busy; not saving this invocation.\n", logstr, path);
+      skipped_saves++;
+      close(fd);
+      return 1;
+    }
+    limited_log(0, "%s: Unable to lock statistics file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  memset(&saved, 0, sizeof(saved));
+  if ((bytes = pread(fd, buf, sizeof(buf) - 1, 0)) < 0) {
+    bytes = 0;
+  }
+  buf[bytes] = '\0';
+  parse_stats(buf, &saved);
+
+  saved.invocations++;
+  saved.skipped += skipped_saves;
+  for (idx = 0; idx < STATS_COUNTER_COUNT; idx++) {
+    saved.counters[idx] += counters[idx];
+  }
+  for (idx = 0; idx < STATS_PHASE_COUNT; idx++) {
+    if (phase_seen[idx]) {
+      saved.count[idx]++;
+      saved.total_us[idx] += phase_us[idx];
+      saved.histogram[idx][bucket(phase_us[idx])]++;
+    }
+  }
+
+  len = format_stats(&saved, buf, sizeof(buf));
+  if ((len >= sizeof(buf)) || (ftruncate(fd, 0) == -1) || (pwrite(fd, buf, len, 0) != (ssize_t)len)) {
+    limited_log(0, "%s: Unable to write statistics file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    result = -1;
+  }
+  if (!result) {
+    skipped_saves = 0;
+  }
+  close(fd); // Releases the lock.
+  return result;
+}
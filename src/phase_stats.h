@@ -0,0 +1,67 @@
+#ifndef __PHASE_STATS_H
+#define __PHASE_STATS_H
+
+/*
+ * Per-invocation latency and counters for the phases of a mapping, so a slow
+ * glexec can be pinned on discovery, environ reading, the user lookup or the
+ * fork.  The plugin resets them at the start of plugin_run, logs a one-line
+ * summary at the end, and may fold them into a node-wide statistics file.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  STATS_USER_IDS,   // get_user_ids, including any passwd lookup
+  STATS_DISCOVERY,  // building or refreshing the process snapshot
+  STATS_ENVIRON,    // finding the starter and reading its environment
+  STATS_PARENT_IDS, // getParentIDs
+  STATS_SPAWN,      // fork or posix_spawn of the privilege-dropped child
+  STATS_CHILD,      // waiting for the child to daemonize or report an error
+  STATS_TOTAL,      // all of plugin_run
+  STATS_PHASE_COUNT
+};
+
+enum {
+  STATS_PROCESSES,  // /proc status files parsed
+  STATS_BYTES_READ, // bytes read from /proc
+  STATS_FORKS,      // processes started by the plugin itself
+  STATS_CACHE_HITS, // starters found in the node-wide discovery cache
+  STATS_SCAN_SYSCALLS, // system calls made to read status files in full scans
+  STATS_USER_CACHE_HITS, // user names found in the node-wide user cache
+  STATS_DAEMON_HITS, // queries answered by the discovery daemon
+  STATS_COUNTER_COUNT
+};
+
+/* Monotonic clock, in microseconds. */
+uint64_t stats_now(void);
+
+void stats_reset(void);
+
+/* Charge the time since start (from stats_now) to phase. */
+void stats_record(int phase, uint64_t start);
+
+/* Safe to call from the /proc scan threads. */
+void stats_count(int counter, uint64_t value);
+
+uint64_t stats_counter(int counter);
+
+/* One summary line through lcmaps_log at the given level; exempt from the
+   log rate limit (log_limit.h). */
+void stats_log(int level);
+
+/* Add this invocation to the counters and log2 latency histograms kept in
+   path, creating it if needed.  Concurrent invocations are serialized with
+   flock, waiting no more than a few milliseconds: if another still holds
+   the lock, this invocation is not saved, and only counted (skipped_saves)
+   by a later save from the same process.  Returns 0 on success, 1 if skipped, -1 on error. */
+int stats_save(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+
+/*
+ * lcmaps-condor-update
+ * Allocation-free parsers for /proc/<pid>/status and /proc/<pid>/stat.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <string.h>
+
+#include "proc_status.h"
+
+/* Parse a non-negative decimal number starting at *pos, skipping leading
+   blanks.  Returns -1 if there are no digits. */
+static long parse_decimal(const char **pos, const char *end) {
+  const char *cur = *pos;
+  long value = 0;
+  while ((cur < end) && ((*cur == ' ') || (*cur == '\t'))) cur++;
+  if ((cur == end) || (*cur < '0') || (*cur > '9')) return -1;
+  while ((cur < end) && (*cur >= '0') && (*cur <= '9')) {
+    value = value * 10 + (*cur - '0');
+    if (value > 0x7fffffffL) return -1;
+    cur++;
+  }
+  *pos = cur;
+  return value;
+}
+
+#define HAVE_PPID 1
+#define HAVE_UID  2
+#define HAVE_GID  4
+#define HAVE_NS   8
+#define HAVE_ALL  (HAVE_PPID | HAVE_UID | HAVE_GID)
+
+/* NStgid lists the thread group ID in each PID namespace, from that of the
+   /proc mount down to the one the process lives in. */
+static int parse_nstgid(const char *pos, const char *end, pid_t *ns_pid, int *ns_depth) {
+  long value;
+  int count = 0;
+  while ((value = parse_decimal(&pos, end)) >= 0) {
+    *ns_pid = value;
+    count++;
+  }
+  if (!count) return 1;
+  *ns_depth = count - 1;
+  return 0;
+}
+
+static int parse_status(const char *buf, size_t len, int *uid, int *gid, pid_t *ppid, pid_t *ns_pid, int *ns_depth) {
+  const char *line = buf, *end = buf + len, *next;
+  int found = 0, wanted = ns_pid ? (HAVE_ALL | HAVE_NS) : HAVE_ALL;
+  long value;
+
+  *uid = -1;
+  *gid = -1;
+  *ppid = -1;
+  while ((line < end) && (found != wanted)) {
+    size_t remaining = end - line;
+    if ((remaining > 5) && (memcmp(line, "PPid:", 5) == 0)) {
+      next = line + 5;
+      if ((value = parse_decimal(&next, end)) >= 0) {*ppid = value; found |= HAVE_PPID;}
+    } else if ((remaining > 4) && (memcmp(line, "Uid:", 4) == 0)) {
+      next = line + 4;
+      if ((value = parse_decimal(&next, end)) >= 0) {*uid = value; found |= HAVE_UID;}
+    } else if ((remaining > 4) && (memcmp(line, "Gid:", 4) == 0)) {
+      next = line + 4;
+      if ((value = parse_decimal(&next, end)) >= 0) {*gid = value; found |= HAVE_GID;}
+    } else if (ns_pid && (remaining > 7) && (memcmp(line, "NStgid:", 7) == 0)) {
+      const char *eol = (const char *)memchr(line, '\n', remaining);
+      if (!parse_nstgid(line + 7, eol ? eol : end, ns_pid, ns_depth)) found |= HAVE_NS;
+    }
+    if ((next = (const char *)memchr(line, '\n', remaining)) == NULL) break;
+    line = next + 1;
+  }
+  return ((found & HAVE_ALL) == HAVE_ALL) ? 0 : 1;
+}
+
+int parse_proc_status(const char *buf, size_t len, int *uid, int *gid, pid_t *ppid) {
+  return parse_status(buf, len, uid, gid, ppid, NULL, NULL);
+}
+
+int parse_proc_status_ns(const char *buf, size_t len, int *uid, int *gid, pid_t *ppid, pid_t *ns_pid, int *ns_depth) {
+  *ns_pid = -1;
+  *ns_depth = 0;
+  return parse_status(buf, len, uid, gid, ppid, ns_pid, ns_depth);
+}
+
+/* Returns a pointer to the PPID field of a stat file, or NULL if malformed. */
+static const char * stat_ppid_field(const char *buf, size_t len) {
+  const char *pos, *end = buf + len;
+  // The command name may itself contain spaces and parentheses; the fields
+  // start after the last ')'.  Format: "pid (comm) state ppid ..."
+  if ((pos = (const char *)memrchr(buf, ')', len)) == NULL) return NULL;
+  pos++;
+  if ((end - pos < 4) || (pos[0] != ' ') || (pos[2] != ' ')) return NULL;
+  return pos + 3;
+}
+
+// starttime is field 22; the PPID is field 4.
+#define STAT_FIELDS_TO_SKIP (22 - 4 - 1)
+
+int parse_proc_stat(const char *buf, size_t len, pid_t *ppid, unsigned long long *starttime) {
+  const char *pos, *end = buf + len;
+  unsigned long long value = 0;
+  long parent;
+  int field;
+
+  *ppid = -1;
+  *starttime = 0;
+  if ((pos = stat_ppid_field(buf, len)) == NULL) return 1;
+  if ((parent = parse_decimal(&pos, end)) < 0) return 1;
+  // Fields in between may be negative (tpgid), so just count separators.
+  for (field = 0; field < STAT_FIELDS_TO_SKIP; field++) {
+    if ((pos == end) || (*pos != ' ')) return 1;
+    pos++;
+    while ((pos < end) && (*pos != ' ')) pos++;
+  }
+  if ((end - pos < 2) || (pos[0] != ' ') || (pos[1] < '0') || (pos[1] > '9')) return 1;
+  pos++;
+  while ((pos < end) && (*pos >= '0') && (*pos <= '9')) {
+    value = value * 10 + (*pos - '0');
+    pos++;
+  }
+  *ppid = parent;
+  *starttime = value;
+  return 0;
+}
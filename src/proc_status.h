@@ -0,0 +1,33 @@
+#ifndef __PROC_STATUS_H
+#define __PROC_STATUS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Parse the PPid, (real) Uid and (real) Gid out of the contents of a
+   /proc/<pid>/status file in a single pass, in whatever order the fields
+   appear.  Does not allocate and does not require buf to be NUL-terminated.
+   Returns 0 if all three fields were found, 1 otherwise. */
+int parse_proc_status(const char *buf, size_t len, int *uid, int *gid, pid_t *ppid);
+
+/* As parse_proc_status(), also returning the PID of the process in its own
+   (innermost) PID namespace and how many namespaces that is below the one of
+   the /proc mount, from the NStgid line.  Kernels without NStgid give -1
+   and 0. */
+int parse_proc_status_ns(const char *buf, size_t len, int *uid, int *gid, pid_t *ppid, pid_t *ns_pid, int *ns_depth);
+
+/* Parse the PPID and the start time of the process (in clock ticks since
+   boot), which tells a process apart from a later one that reuses its PID,
+   out of the contents of a /proc/<pid>/stat file.  Returns 0 on success, 1
+   if the contents are malformed. */
+int parse_proc_stat(const char *buf, size_t len, pid_t *ppid, unsigned long long *starttime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,278 @@
+
+/*
+ * lcmaps-condor-update
+ * Batched /proc reads through io_uring; see proc_uring.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "lcmaps/lcmaps_log.h"
+
+#include "proc_uring.h"
+#include "phase_stats.h"
+#include "log_limit.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+// Direct descriptors (file_index) and sparse file tables need the headers of
+// Linux 5.19 or later; anything older gets the stubs at the end.
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(IORING_RSRC_REGISTER_SPARSE)
+
+static const char * logstr = "lcmaps-condor-update";
+
+// Operations linked for each file; the low bits of user_data.
+enum {OP_OPEN, OP_READ, OP_CLOSE, OP_COUNT};
+#define OP_BITS 2
+
+typedef struct {
+  size_t idx;      // Index into the caller's pids.
+  int pending;     // Completions still to come; 0 for a free slot.
+  char path[32];
+  char buf[PROC_URING_BUF];
+} uring_slot_t;
+
+struct proc_uring {
+  int fd;
+  unsigned depth;
+  void *sq_ring;
+  size_t sq_ring_len;
+  void *cq_ring;   // The same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP.
+  size_t cq_ring_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head, *sq_tail, *sq_array, sq_mask;
+  unsigned *cq_head, *cq_tail, cq_mask;
+  struct io_uring_cqe *cqes;
+  uring_slot_t *slots;
+  // After a failed io_uring_enter, reads may still land in the slots.
+  int broken;
+};
+
+static int uring_enter(proc_uring_t *ring, unsigned to_submit, unsigned min_complete) {
+  stats_count(STATS_SCAN_SYSCALLS, 1);
+  return syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+proc_uring_t * proc_uring_open(unsigned depth) {
+  struct io_uring_params params;
+  struct io_uring_rsrc_register files;
+  proc_uring_t *ring;
+  unsigned entries = 1, idx;
+
+  if (!depth) {
+    return NULL;
+  }
+  while (entries < OP_COUNT * depth) {
+    entries *= 2;
+  }
+  if ((ring = calloc(1, sizeof(proc_uring_t))) == NULL) {
+    return NULL;
+  }
+  ring->depth = depth;
+  memset(&params, 0, sizeof(params));
+  if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+    lcmaps_log_debug(2, "%s: io_uring is not available: %d %s\n", logstr, errno, strerror(errno));
+    free(ring);
+    return NULL;
+  }
+  ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_len > ring->sq_ring_len) {
+      ring->sq_ring_len = ring->cq_ring_len;
+    }
+    ring->cq_ring_len = ring->sq_ring_len;
+  }
+  ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    ring->sq_ring = NULL;
+    goto fail;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      ring->cq_ring = NULL;
+      goto fail;
+    }
+  }
+  ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+  ring->sq_head = (unsigned *)((char *)ring->sq_ring + params.sq_off.head);
+  ring->sq_tail = (unsigned *)((char *)ring->sq_ring + params.sq_off.tail);
+  ring->sq_array = (unsigned *)((char *)ring->sq_ring + params.sq_off.array);
+  ring->sq_mask = *(unsigned *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+  ring->cq_head = (unsigned *)((char *)ring->cq_ring + params.cq_off.head);
+  ring->cq_tail = (unsigned *)((char *)ring->cq_ring + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + params.cq_off.cqes);
+  for (idx = 0; idx < params.sq_entries; idx++) {
+    ring->sq_array[idx] = idx;
+  }
+
+  // One direct descriptor per slot; fails on kernels without sparse tables.
+  memset(&files, 0, sizeof(files));
+  files.nr = depth;
+  files.flags = IORING_RSRC_REGISTER_SPARSE;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0) {
+    lcmaps_log_debug(2, "%s: io_uring has no direct descriptors: %d %s\n", logstr, errno, strerror(errno));
+    goto fail;
+  }
+  if ((ring->slots = calloc(depth, sizeof(uring_slot_t))) == NULL) {
+    goto fail;
+  }
+  // Setup, the mappings and the file table.
+  stats_count(STATS_SCAN_SYSCALLS, (params.features & IORING_FEAT_SINGLE_MMAP) ? 4 : 5);
+  return ring;
+
+fail:
+  proc_uring_close(ring);
+  return NULL;
+}
+
+void proc_uring_close(proc_uring_t *ring) {
+  if (!ring) {
+    return;
+  }
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if (ring->cq_ring && (ring->cq_ring != ring->sq_ring)) {
+    munmap(ring->cq_ring, ring->cq_ring_len);
+  }
+  if (ring->sq_ring) {
+    munmap(ring->sq_ring, ring->sq_ring_len);
+  }
+  close(ring->fd);
+  // Leak the buffers rather than free memory the kernel may still write to.
+  if (!ring->broken) {
+    free(ring->slots);
+  }
+  free(ring);
+}
+
+static void queue_sqe(proc_uring_t *ring, uint8_t opcode, int fd, const void *addr, unsigned len, uint8_t flags, uint64_t user_data, unsigned file_index) {
+  unsigned tail = *ring->sq_tail;
+  struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)addr;
+  sqe->len = len;
+  sqe->flags = flags;
+  sqe->user_data = user_data;
+  sqe->file_index = file_index;
+  // Direct descriptors are never inherited; the kernel refuses O_CLOEXEC.
+  if (opcode == IORING_OP_OPENAT) {
+    sqe->open_flags = O_RDONLY;
+  }
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// openat into the slot's direct descriptor, read, and close.  A failed open
+// cancels the rest of the chain; the close is hard-linked so that it runs
+// even if the read fails.
+static void queue_file(proc_uring_t *ring, unsigned slot, int dirfd) {
+  uring_slot_t *s = &ring->slots[slot];
+  uint64_t key = (uint64_t)slot << OP_BITS;
+  s->pending = OP_COUNT;
+  queue_sqe(ring, IORING_OP_OPENAT, dirfd, s->path, 0, IOSQE_IO_LINK, key | OP_OPEN, slot + 1);
+  queue_sqe(ring, IORING_OP_READ, slot, s->buf, PROC_URING_BUF, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK, key | OP_READ, 0);
+  queue_sqe(ring, IORING_OP_CLOSE, 0, NULL, 0, 0, key | OP_CLOSE, slot + 1);
+}
+
+size_t proc_uring_read(proc_uring_t *ring, int dirfd, const pid_t *pids, size_t count, const char *name,
+                       proc_uring_cb_t cb, void *arg) {
+  size_t next = 0, delivered = 0;
+  unsigned slot, in_flight = 0;
+
+  if (ring->broken) {
+    return 0;
+  }
+  while ((next < count) || in_flight) {
+    // Refill every free slot, then wait for about half of what is in flight,
+    // so the kernel has work queued while completions are parsed.
+    for (slot = 0; (slot < ring->depth) && (next < count); slot++) {
+      uring_slot_t *s = &ring->slots[slot];
+      if (s->pending) {
+        continue;
+      }
+      s->idx = next++;
+      snprintf(s->path, sizeof(s->path), "%d/%s", pids[s->idx], name);
+      queue_file(ring, slot, dirfd);
+      in_flight++;
+    }
+    unsigned to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (uring_enter(ring, to_submit, OP_COUNT * ((in_flight + 1) / 2)) < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+        continue;
+      }
+      limited_log(0, "%s: io_uring_enter failed: %d %s\n", logstr, errno, strerror(errno));
+      ring->broken = 1;
+      return delivered;
+    }
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+      uring_slot_t *s = &ring->slots[cqe->user_data >> OP_BITS];
+      switch (cqe->user_data & ((1 << OP_BITS) - 1)) {
+      case OP_OPEN:
+        // EINVAL means the kernel does not take this kind of request, not
+        // that the process is gone; leave the file to the caller.
+        if ((cqe->res < 0) && (cqe->res != -EINVAL)) {
+          cb(arg, s->idx, -cqe->res, NULL, 0);
+          delivered++;
+        }
+        break;
+      case OP_READ:
+        // Cancelled only because the open failed, which was reported.
+        if (cqe->res != -ECANCELED) {
+          cb(arg, s->idx, 0, s->buf, cqe->res);
+          delivered++;
+        }
+        break;
+      }
+      if (--s->pending == 0) {
+        in_flight--;
+      }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+  return delivered;
+}
+
+#else
+
+proc_uring_t * proc_uring_open(unsigned depth) {
+  return NULL;
+}
+
+void proc_uring_close(proc_uring_t *ring) {
+}
+
+size_t proc_uring_read(proc_uring_t *ring, int dirfd, const pid_t *pids, size_t count, const char *name,
+                       proc_uring_cb_t cb, void *arg) {
+  return 0;
+}
+
+#endif
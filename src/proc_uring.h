@@ -0,0 +1,46 @@
+#ifndef __PROC_URING_H
+#define __PROC_URING_H
+
+/*
+ * Batched reads of per-process /proc files through io_uring, for full scans
+ * of /proc.  Each file is an openat, a read and a close linked in the ring,
+ * using a direct (ring-private) descriptor, so a whole batch of files costs
+ * one io_uring_enter instead of three system calls per file.  Needs Linux
+ * 5.19 or later; on older kernels, or where io_uring is disabled, opening the
+ * ring fails and the caller reads the files itself.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes read from each file; one read, like the plain /proc scan. */
+#define PROC_URING_BUF 4096
+
+typedef struct proc_uring proc_uring_t;
+
+/* Called once per file, in completion order.  open_errno is non-zero if the
+   file could not be opened; otherwise len is the number of bytes read into
+   buf (valid only during the call), or -errno. */
+typedef void (*proc_uring_cb_t)(void *arg, size_t idx, int open_errno, const char *buf, ssize_t len);
+
+/* A ring with depth files in flight; NULL if io_uring cannot be used. */
+proc_uring_t * proc_uring_open(unsigned depth);
+
+void proc_uring_close(proc_uring_t *ring);
+
+/* Read <pids[idx]>/<name> relative to the directory dirfd, for every idx
+   below count.  Returns the number of files the callback was called for;
+   fewer than count if the ring failed part way, in which case the caller
+   must read the others itself (and the ring should be closed). */
+size_t proc_uring_read(proc_uring_t *ring, int dirfd, const pid_t *pids, size_t count, const char *name,
+                       proc_uring_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+
+/*
+ * lcmaps-condor-update
+ * Stand-ins for the LCMAPS credential and argument functions the plugin
+ * uses, so the plugin itself can be driven outside of LCMAPS by the stress
+ * harness.  The mapped account is whatever standalone_uid/standalone_gid
+ * are set to.
+ * This code is under the public domain
+ */
+
+#include <string.h>
+#include <sys/types.h>
+
+#include "lcmaps/lcmaps_modules.h"
+#include "lcmaps/lcmaps_cred_data.h"
+#include "lcmaps/lcmaps_arguments.h"
+
+uid_t standalone_uid;
+gid_t standalone_gid;
+
+void *getCredentialData(int datatype, int *count) {
+  *count = 1;
+  if (datatype == UID) {
+    return &standalone_uid;
+  } else if (datatype == PRI_GID) {
+    return &standalone_gid;
+  }
+  *count = 0;
+  return NULL;
+}
+
+int lcmaps_cntArgs(lcmaps_argument_t *argv) {
+  int count = 0;
+  while (argv[count].argName) {
+    count++;
+  }
+  return count;
+}
+
+void *lcmaps_getArgValue(char *argName, char *argType, int argcx, lcmaps_argument_t *argvx) {
+  int idx;
+  for (idx = 0; idx < argcx; idx++) {
+    if ((strcmp(argvx[idx].argName, argName) == 0) && (strcmp(argvx[idx].argType, argType) == 0)) {
+      return argvx[idx].value;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,41 @@
+
+/*
+ * lcmaps-condor-update
+ * Stand-ins for the LCMAPS logging functions, so the discovery code can be
+ * linked into command line tools and benchmarks without LCMAPS itself.
+ * Messages go to stderr; debug messages only if CONDOR_DISCOVERY_DEBUG is set.
+ * This code is under the public domain
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "lcmaps/lcmaps_log.h"
+
+int lcmaps_log(int prty, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  return 0;
+}
+
+int lcmaps_log_time(int prty, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  return 0;
+}
+
+int lcmaps_log_debug(int debug_lvl, const char *fmt, ...) {
+  va_list ap;
+  if (!getenv("CONDOR_DISCOVERY_DEBUG")) {
+    return 0;
+  }
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  return 0;
+}
@@ -0,0 +1,494 @@
+
+/*
+ * lcmaps-condor-update
+ * This code is under the public domain
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+
+#include "lcmaps/lcmaps_modules.h"
+
+#include "chirp_client.h"
+#include "starter_update.h"
+#include "update_state.h"
+#include "log_limit.h"
+
+#ifndef CONDOR_CHIRP_PATH
+#define CONDOR_CHIRP_PATH "/usr/libexec/condor/condor_chirp"
+#endif
+#define CONDOR_CHIRP_NAME "condor_chirp"
+
+#define RESULT_BUFFER_SIZE 12
+#define HISTORY_VALUE_SIZE 24
+
+static const char * logstr = "lcmaps-condor-update";
+
+static int exec_chirp(const classad_update_t *update, char * const environ[]) {
+  char *const argv[] = {CONDOR_CHIRP_NAME,
+               "set_job_attr",
+               (char *)update->attr,
+               (char *)update->val,
+               NULL
+              };
+  int result;
+  execve(CONDOR_CHIRP_PATH, argv, environ);
+  result = errno;
+  limited_log(0, "%s: Exec of condor_chirp failed: %d %s\n", logstr, result, strerror(result));
+  return result;
+}
+
+/*
+ * Send the updates over a single native Chirp connection.  Returns the number
+ * of updates handled; anything short of count should be retried through
+ * condor_chirp.  sent[idx] is set for each update the starter accepted.
+ */
+static size_t update_starter_native(const classad_update_t *updates, size_t count, const char * config, char *sent) {
+  size_t idx;
+  int chirp_fd, rc;
+
+  if ((chirp_fd = chirp_client_connect(config)) == -1) {
+    return 0;
+  }
+  for (idx = 0; idx < count; idx++) {
+    if ((rc = chirp_client_set_job_attr(chirp_fd, updates[idx].attr, updates[idx].val)) == -1) {
+      limited_log(0, "%s: Chirp connection lost while updating %s: %d %s\n", logstr, updates[idx].attr, errno, strerror(errno));
+      break;
+    } else if (rc) {
+      // The starter understood and refused the request; condor_chirp would fare no better.
+      limited_log(0, "%s: Starter rejected ClassAd update %s=%s: %d\n", logstr, updates[idx].attr, updates[idx].val, rc);
+    } else {
+      sent[idx] = 1;
+    }
+  }
+  chirp_client_close(chirp_fd);
+  return idx;
+}
+
+/*
+ * Copy into pending the updates the starter does not already have, according
+ * to state; returns how many there are.
+ */
+static size_t select_updates(const classad_update_t *updates, size_t count, const update_state_t *state,
+                             const update_options_t *options, time_t now, classad_update_t *pending) {
+  const update_state_entry_t *entry;
+  size_t idx, pending_count = 0;
+
+  for (idx = 0; idx < count; idx++) {
+    if ((entry = update_state_find(state, updates[idx].attr))) {
+      if (options->throttle_attr && (strcmp(updates[idx].attr, options->throttle_attr) == 0)) {
+        if (now - entry->when < options->throttle_interval) {
+          continue;
+        }
+      } else if (strcmp(entry->val, updates[idx].val) == 0) {
+        continue;
+      }
+    }
+    pending[pending_count++] = updates[idx];
+  }
+  return pending_count;
+}
+
+/* Record the updates the starter accepted in the state file. */
+static void record_updates(const char *state_path, const update_state_t *state, classad_update_t *pending,
+                           const char *sent, size_t count, time_t now) {
+  size_t idx, sent_count = 0;
+  for (idx = 0; idx < count; idx++) {
+    if (sent[idx]) {
+      pending[sent_count++] = pending[idx];
+    }
+  }
+  update_state_save(state_path, state, pending, sent_count, now);
+}
+
+/*
+ * Count this invocation in the job's history file and append the resulting
+ * totals to pending, less any the starter already has according to state.
+ * values receives the formatted totals, which pending points into.
+ */
+static size_t add_history_updates(const char *path, const classad_update_t *updates, size_t count,
+                                  const update_state_t *state, const update_options_t *options, time_t now,
+                                  char values[HISTORY_ATTR_COUNT][HISTORY_VALUE_SIZE], classad_update_t *pending) {
+  char history_path[PATH_MAX];
+  update_history_t history;
+  classad_update_t totals[HISTORY_ATTR_COUNT];
+  const char *user = NULL;
+  size_t idx;
+
+  for (idx = 0; idx < count; idx++) {
+    if (strcmp(updates[idx].attr, options->history_attr) == 0) {
+      user = updates[idx].val;
+    }
+  }
+  if (!user) {
+    limited_log(0, "%s: No %s in the update; not recording history.\n", logstr, options->history_attr);
+    return 0;
+  }
+  if (snprintf(history_path, PATH_MAX, "%s%s", path, UPDATE_HISTORY_SUFFIX) >= PATH_MAX) {
+    limited_log(0, "%s: Overly long history path for %s; not recording history.\n", logstr, path);
+    return 0;
+  }
+  if (update_history_record(history_path, user, now, &history)) {
+    return 0;
+  }
+  snprintf(values[0], HISTORY_VALUE_SIZE, "%u", history.count);
+  snprintf(values[1], HISTORY_VALUE_SIZE, "%u", history.distinct_users);
+  snprintf(values[2], HISTORY_VALUE_SIZE, "%lld", (long long)history.first_time);
+  totals[0].attr = CLASSAD_GLEXEC_COUNT;
+  totals[0].val = values[0];
+  totals[1].attr = CLASSAD_GLEXEC_DISTINCT_USERS;
+  totals[1].val = values[1];
+  totals[2].attr = CLASSAD_GLEXEC_FIRST_TIME;
+  totals[2].val = values[2];
+  return select_updates(totals, HISTORY_ATTR_COUNT, state, options, now, pending);
+}
+
+// Where a backend sends the updates.  The update state and history files
+// are kept next to path.
+typedef struct {
+  char path[PATH_MAX];    // The chirp config, or the file to drop.
+  char environ[PATH_MAX]; // How condor_chirp finds the chirp config.
+  int can_exec;           // Whether condor_chirp can be exec'd.
+} update_target_t;
+
+/*
+ * A way of passing the updates on.  locate does the checks that can fail
+ * cheaply, while the parent still waits for the result.  Backends that talk
+ * to the starter detach before sending: the child daemonizes and releases
+ * the parent, as the (single-threaded) starter may be slow to answer.
+ */
+typedef struct {
+  // Fill in target; returns 0, or the error to report to the parent.
+  int (*locate)(const char *scratch_dir, const update_options_t *options, update_target_t *target);
+  // Pass count updates on, setting sent[idx] for each that got through.  With
+  // may_exec, the process may be replaced by the last condor_chirp.  Returns
+  // 0 or an errno.
+  int (*send)(const update_target_t *target, const classad_update_t *updates, size_t count, char *sent, int may_exec);
+  int detach;
+  // Takes any subset of the attributes, so that unchanged ones can be skipped.
+  int partial;
+} update_backend_t;
+
+static int locate_chirp_config(const char *scratch_dir, const update_options_t *options, update_target_t *target) {
+  int use_chirp_config = 0;
+  struct stat chirp_file;
+  if (stat(scratch_dir, &chirp_file) == -1)
+  {
+    limited_log(0, "%s: Scratch location %s not found (errno=%d, %s).\n", logstr, scratch_dir, errno, strerror(errno));
+    return 1;
+  }
+  if (S_ISREG(chirp_file.st_mode))
+  {
+    if (snprintf(target->path, PATH_MAX, "%s", scratch_dir) >= PATH_MAX)
+    {
+      limited_log(0, "%s: Chirp config filename overly long.\n", logstr);
+      return 1;
+    }
+    use_chirp_config = 1;
+  }
+  else if (snprintf(target->path, PATH_MAX, "%s/chirp.config", scratch_dir) >= PATH_MAX)
+  {
+    limited_log(0, "%s: Overly long scratch dir: %s\n", logstr, scratch_dir);
+    return 1;
+  }
+  else if (stat(target->path, &chirp_file) == -1)
+  {
+    if (snprintf(target->path, PATH_MAX, "%s/.chirp.config", scratch_dir) >= PATH_MAX)
+    {
+      limited_log(0, "%s: Overly long scratch dir: %s\n", logstr, scratch_dir);
+      return 1;
+    }
+  }
+
+  if (access(target->path, O_RDONLY) == -1) {
+    limited_log(0, "%s: Unable to access chirp config %s\n", logstr, target->path);
+    return 1;
+  }
+  if (use_chirp_config)
+  {
+    if (snprintf(target->environ, PATH_MAX, "_CONDOR_CHIRP_CONFIG=%s", scratch_dir) >= PATH_MAX)
+    {
+      limited_log(0, "%s: Overly long chirp config path: %s\n", logstr, scratch_dir);
+      return 1;
+    }
+  }
+  else if (snprintf(target->environ, PATH_MAX, "_CONDOR_SCRATCH_DIR=%s", scratch_dir) >= PATH_MAX) {
+    limited_log(0, "%s: Overly long scratch dir: %s\n", logstr, scratch_dir);
+    return 1;
+  }
+  target->can_exec = (access(CONDOR_CHIRP_PATH, X_OK) == 0);
+  return 0;
+}
+
+static int locate_exec_chirp(const char *scratch_dir, const update_options_t *options, update_target_t *target) {
+  int result;
+  if ((result = locate_chirp_config(scratch_dir, options, target))) {
+    return result;
+  }
+  if (access(CONDOR_CHIRP_PATH, X_OK) == -1) {
+    result = errno;
+    limited_log(0, "%s: Unable to execute %s: %d %s\n", logstr, CONDOR_CHIRP_PATH, result, strerror(result));
+    return result;
+  }
+  return 0;
+}
+
+// The scratch directory, or the directory of the chirp config.
+static int locate_drop_file(const char *scratch_dir, const update_options_t *options, update_target_t *target) {
+  const char *name = options->drop_name ? options->drop_name : UPDATE_DROP_NAME;
+  const char *slash;
+  struct stat st;
+  int len;
+  if (stat(scratch_dir, &st) == -1) {
+    limited_log(0, "%s: Scratch location %s not found (errno=%d, %s).\n", logstr, scratch_dir, errno, strerror(errno));
+    return 1;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    len = snprintf(target->path, PATH_MAX, "%s/%s", scratch_dir, name);
+  } else if ((slash = strrchr(scratch_dir, '/'))) {
+    len = snprintf(target->path, PATH_MAX, "%.*s/%s", (int)(slash - scratch_dir), scratch_dir, name);
+  } else {
+    len = snprintf(target->path, PATH_MAX, "%s", name);
+  }
+  if (len >= PATH_MAX) {
+    limited_log(0, "%s: Overly long drop file path in %s\n", logstr, scratch_dir);
+    return 1;
+  }
+  target->environ[0] = '\0';
+  target->can_exec = 0;
+  return 0;
+}
+
+// condor_chirp sets a single attribute per invocation.  Run them one after
+// another so the starter sees at most one of our requests at a time.
+static int send_exec_chirp(const update_target_t *target, const classad_update_t *updates, size_t count, char *sent, int may_exec) {
+  char * environ[2] = {(char *)target->environ, NULL};
+  size_t idx;
+  for (idx = 0; idx < count; idx++) {
+    int status;
+    if ((idx + 1 == count) && may_exec) {
+      _exit(exec_chirp(&updates[idx], environ));
+    }
+    pid_t chirp_pid = fork();
+    if (chirp_pid == -1) {
+      limited_log(0, "%s: Fork of condor_chirp for %s failed: %d %s\n", logstr, updates[idx].attr, errno, strerror(errno));
+      continue;
+    } else if (chirp_pid == 0) {
+      _exit(exec_chirp(&updates[idx], environ));
+    }
+    if ((waitpid(chirp_pid, &status, 0) == -1) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      limited_log(0, "%s: ClassAd update %s=%s failed.\n", logstr, updates[idx].attr, updates[idx].val);
+    } else {
+      sent[idx] = 1;
+    }
+  }
+  return 0;
+}
+
+static int send_native_chirp(const update_target_t *target, const classad_update_t *updates, size_t count, char *sent, int may_exec) {
+  size_t idx;
+  if ((idx = update_starter_native(updates, count, target->path, sent)) == count) {
+    return 0;
+  }
+  if (!target->can_exec) {
+    limited_log(0, "%s: Native Chirp update failed and %s is unavailable.\n", logstr, CONDOR_CHIRP_PATH);
+    return EIO;
+  }
+  limited_log(1, "%s: Falling back to %s for %lu remaining updates.\n", logstr, CONDOR_CHIRP_PATH, (unsigned long)(count - idx));
+  return send_exec_chirp(target, updates + idx, count - idx, sent + idx, may_exec);
+}
+
+/*
+ * Write the updates, one "attr = value" line each, to a temporary file next
+ * to the drop file and rename it into place, so that whoever harvests the
+ * file never sees a partial batch.
+ */
+static int send_drop_file(const update_target_t *target, const classad_update_t *updates, size_t count, char *sent, int may_exec) {
+  char tmp_path[PATH_MAX];
+  FILE *fp;
+  size_t idx;
+  int fd, result, write_error;
+
+  if (snprintf(tmp_path, PATH_MAX, "%s.XXXXXX", target->path) >= PATH_MAX) {
+    limited_log(0, "%s: Overly long drop file path: %s\n", logstr, target->path);
+    return ENAMETOOLONG;
+  }
+  if ((fd = mkstemp(tmp_path)) == -1) {
+    result = errno;
+    limited_log(0, "%s: Unable to create %s: %d %s\n", logstr, tmp_path, result, strerror(result));
+    return result;
+  }
+  // The values are in the job ad anyway; let the harvester read them
+  // whatever account it runs as.
+  if ((fchmod(fd, 0644) == -1) || ((fp = fdopen(fd, "w")) == NULL)) {
+    result = errno;
+    limited_log(0, "%s: Unable to set up %s: %d %s\n", logstr, tmp_path, result, strerror(result));
+    close(fd);
+    unlink(tmp_path);
+    return result;
+  }
+  for (idx = 0; idx < count; idx++) {
+    // A value spanning lines would be read back as another attribute.
+    if (strchr(updates[idx].attr, '\n') || strchr(updates[idx].val, '\n')) {
+      limited_log(0, "%s: Not dropping ClassAd update %s, which contains a newline.\n", logstr, updates[idx].attr);
+      continue;
+    }
+    fprintf(fp, "%s = %s\n", updates[idx].attr, updates[idx].val);
+    sent[idx] = 1;
+  }
+  write_error = ferror(fp);
+  if ((result = (fclose(fp) == EOF) ? errno : (write_error ? EIO : 0))) {
+    limited_log(0, "%s: Unable to write %s: %d %s\n", logstr, tmp_path, result, strerror(result));
+    unlink(tmp_path);
+    return result;
+  }
+  if (rename(tmp_path, target->path) == -1) {
+    result = errno;
+    limited_log(0, "%s: Unable to rename %s to %s: %d %s\n", logstr, tmp_path, target->path, result, strerror(result));
+    unlink(tmp_path);
+    return result;
+  }
+  return 0;
+}
+
+static const update_backend_t update_backends[UPDATE_BACKEND_COUNT] = {
+  {locate_chirp_config, send_native_chirp, 1, 1}, // UPDATE_BACKEND_NATIVE_CHIRP
+  {locate_exec_chirp, send_exec_chirp, 1, 1},     // UPDATE_BACKEND_EXEC_CHIRP
+  {locate_drop_file, send_drop_file, 0, 0}        // UPDATE_BACKEND_FILE_DROP
+};
+
+void update_starter_child(const classad_update_t *updates, size_t count, int fd, const char * scratch_dir, uid_t uid, gid_t gid, const update_options_t *options) {
+  size_t len;
+  int result = 1;
+  char result_buf[RESULT_BUFFER_SIZE];
+  const update_backend_t *backend;
+  update_target_t target;
+  int suppress;
+
+  if ((options->backend < 0) || (options->backend >= UPDATE_BACKEND_COUNT)) {
+    limited_log(0, "%s: Unknown update backend %d\n", logstr, options->backend);
+    result = EINVAL;
+    goto condor_update_fail_child;
+  }
+  backend = &update_backends[options->backend];
+  suppress = options->suppress && backend->partial;
+
+  if (setgid(gid) == -1) {
+    limited_log(0, "%s: Unable to switch to user's GID (%d): %d %s\n", logstr, gid, errno, strerror(errno));
+    result = errno;
+    goto condor_update_fail_child;
+  }
+  if (setuid(uid) == -1) {
+    limited_log(0, "%s: Unable to switch to user's UID (%d): %d %s\n", logstr, uid, errno, strerror(errno));
+    result = errno;
+    goto condor_update_fail_child;
+  }
+
+  if ((result = backend->locate(scratch_dir, options, &target))) {
+    goto condor_update_fail_child;
+  }
+
+  // Drop the updates the starter already has from an earlier invocation.
+  char state_path[PATH_MAX];
+  update_state_t state;
+  classad_update_t *pending;
+  char *sent;
+  char history_values[HISTORY_ATTR_COUNT][HISTORY_VALUE_SIZE];
+  size_t pending_count;
+  time_t now = time(NULL);
+  state.count = 0;
+  if (suppress) {
+    if (snprintf(state_path, PATH_MAX, "%s%s", target.path, UPDATE_STATE_SUFFIX) >= PATH_MAX) {
+      limited_log(0, "%s: Overly long update state path for %s; not suppressing updates.\n", logstr, target.path);
+      suppress = 0;
+    } else if (update_state_lock(state_path) == -1) {
+      suppress = 0;
+    } else {
+      // The lock stays held through the send and the record, until this
+      // process (or the one it detaches into) exits.
+      update_state_load(state_path, &state);
+    }
+  }
+  if (((pending = (classad_update_t *)malloc((count + HISTORY_ATTR_COUNT) * sizeof(classad_update_t))) == NULL) ||
+      ((sent = (char *)calloc(count + HISTORY_ATTR_COUNT, 1)) == NULL)) {
+    limited_log(0, "%s: Malloc failed for the list of updates.\n", logstr);
+    result = ENOMEM;
+    goto condor_update_fail_child;
+  }
+  // With a history, the count changes on every invocation.
+  if (((pending_count = select_updates(updates, count, &state, options, now, pending)) == 0) && !options->history_attr) {
+    limited_log(2, "%s: Starter already has all %lu attributes; nothing to update.\n", logstr, (unsigned long)count);
+    _exit(0);
+  }
+
+  if (backend->detach) {
+    // Nuke fd 1 and 2 to prevent condor_chirp from spilling out information to stdout/err
+    // Writing to stdout/err for a successful execution causes condor glexec integration to choke.
+    int fd_null;
+    if ((fd_null = open("/dev/null", O_WRONLY)) == -1) {
+      limited_log(0, "%s: Opening of /dev/null failed: %d %s\n", logstr, errno, strerror(errno));
+      result = errno;
+      goto condor_update_fail_child;
+    }
+    if (dup2(fd_null, 1) == -1) {
+      limited_log(0, "%s: Duping of /dev/null to stdout failed: %d %s\n", logstr, errno, strerror(errno));
+      result = errno;
+      goto condor_update_fail_child;
+    }
+    if (dup2(fd_null, 2) == -1) {
+      limited_log(0, "%s: Duping of /dev/null to stderr failed: %d %s\n", logstr, errno, strerror(errno));
+      result = errno;
+      goto condor_update_fail_child;
+    }
+
+    // Cheap daemonize - causes condor_chirp to attach to init to avoid zombies
+    int fork_pid = fork();
+    if (fork_pid == -1) {
+      limited_log(0, "%s: Daemonization of condor_chirp failed: %d %s\n", logstr, errno, strerror(errno));
+      result = errno;
+      goto condor_update_fail_child;
+    } else if (fork_pid) { // Parent
+      _exit(0);
+    }
+
+    // Everything that can fail cheaply has been checked; release the parent
+    // now so it does not block on the (single-threaded) starter.
+    close(fd);
+  }
+
+  // Recorded only now, so that with the Chirp backends the file I/O does
+  // not delay glexec.
+  if (options->history_attr) {
+    pending_count += add_history_updates(target.path, updates, count, &state, options, now, history_values, pending + pending_count);
+    if (!pending_count) {
+      goto condor_update_done_child;
+    }
+  }
+
+  // Unless the results have to be recorded, the last condor_chirp replaces
+  // this process.  A backend that did not detach reports its failure.
+  if ((result = backend->send(&target, pending, pending_count, sent, !suppress)) && !backend->detach) {
+    goto condor_update_fail_child;
+  }
+
+condor_update_done_child:
+  if (suppress) {
+    record_updates(state_path, &state, pending, sent, pending_count, now);
+  }
+  _exit(0);
+
+condor_update_fail_child:
+  len = snprintf(result_buf, RESULT_BUFFER_SIZE, "%d", result);
+  if (write(fd, result_buf, len) == -1) {
+    limited_log(0, "%s: Unable to return failed result to parent: %d %s\n", logstr, errno, strerror(errno));
+  }
+  _exit(result);
+}
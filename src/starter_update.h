@@ -0,0 +1,67 @@
+#ifndef __STARTER_UPDATE_H
+#define __STARTER_UPDATE_H
+
+/*
+ * The privilege-dropped half of a ClassAd update: switch to the job's
+ * UID/GID, find where the updates go in the scratch directory and hand the
+ * attributes to the configured backend: the starter over Chirp (after
+ * daemonizing), or a file dropped in the scratch directory for the site to
+ * harvest.  Shared by the plugin's fork path and by condor_update_helper,
+ * which the plugin can spawn instead of forking.
+ */
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where the updates go.
+#define UPDATE_BACKEND_NATIVE_CHIRP 0 // in-process Chirp client, condor_chirp as a fallback
+#define UPDATE_BACKEND_EXEC_CHIRP   1 // always exec condor_chirp
+#define UPDATE_BACKEND_FILE_DROP    2 // replace a file in the scratch directory; no exec, no network
+#define UPDATE_BACKEND_COUNT        3
+
+// Name of the dropped file, in the scratch directory (next to the chirp
+// config if the job only has that).
+#define UPDATE_DROP_NAME ".lcmaps_update.ad"
+
+typedef struct {
+  const char *attr;
+  const char *val;
+} classad_update_t;
+
+typedef struct {
+  int backend;
+  // Skip attributes whose value the starter already has, according to the
+  // job's update state file (see update_state.h).
+  int suppress;
+  // With suppress: an attribute whose value changes on every call (the
+  // invocation time), sent at most once every throttle_interval seconds.
+  const char *throttle_attr;
+  long throttle_interval;
+  // If set, count this invocation in the job's history file (see
+  // update_state.h), with the value of this attribute as the user, and send
+  // the totals along with the other attributes.
+  const char *history_attr;
+  // With the file-drop backend: the name of the file; UPDATE_DROP_NAME if
+  // NULL.  Every drop replaces the whole file, so suppress does not apply.
+  const char *drop_name;
+} update_options_t;
+
+// Attributes sent from the job's history.
+#define CLASSAD_GLEXEC_COUNT "glexec_count"
+#define CLASSAD_GLEXEC_DISTINCT_USERS "glexec_distinct_users"
+#define CLASSAD_GLEXEC_FIRST_TIME "glexec_first_time"
+#define HISTORY_ATTR_COUNT 3
+
+/* Never returns.  Errors found before daemonizing are written to fd as a
+   decimal errno; once the updates are under way fd is closed, so the
+   parent sees EOF and only has to reap the (immediately exiting) child. */
+void update_starter_child(const classad_update_t *updates, size_t count, int fd, const char *scratch_dir, uid_t uid, gid_t gid, const update_options_t *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
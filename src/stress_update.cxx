@@ -0,0 +1,541 @@
+/*
+ * Stress harness for the update path: runs bursts of concurrent plugin_run
+ * invocations, each in its own process as glexec would be, against a
+ * synthetic proc tree and a single-threaded stand-in for the starter's Chirp
+ * server with a configurable service time.  Reports the latency of
+ * plugin_run (what glexec waits for), how many processes the plugin forked
+ * and how many times condor_chirp was executed, how deep the queue of
+ * connections waiting on the starter got, how many user names came from
+ * the node-wide user cache (uhits), and how many lookups the discovery daemon
+ * answered (dhits).
+ *
+ *   stress_update [-n concurrent] [-r rounds] [-l latency_ms] [-p processes] [-u nss_delay_ms] [-D] [-v] [-- plugin options]
+ *
+ * The plugin's passwd lookups go to a files-only stand-in for NSS that waits
+ * nss_delay_ms (default 0) before answering, like a cold sssd or LDAP lookup.
+ * Each invocation also gets the payload's name as the run argument
+ * requested_username, for "-- -username-arg requested_username".
+ *
+ * Plugin options are passed to plugin_initialize after -proc-root and
+ * -cgroup off; e.g. "-- -spawn helper" or "-- -chirp exec -suppress on".
+ * With "-- -backend file-drop" nothing reaches the starter; the harness
+ * checks the dropped file in the scratch directory instead.
+ *
+ * With -D, the plugin asks condor_discovery_daemon, run on the fake tree; the
+ * harness replays a fork event for each glexec and an exit when it is gone,
+ * and every lookup must be answered by the daemon.
+ */
+
+#include <time.h>
+#include <poll.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "lcmaps/lcmaps_modules.h"
+
+int plugin_initialize(int argc, char **argv);
+int plugin_run(int argc, lcmaps_argument_t *argv);
+int plugin_terminate();
+
+extern uid_t standalone_uid;
+extern gid_t standalone_gid;
+}
+
+#include "fake_proc.h"
+
+#define CHIRP_COOKIE "stress-cookie"
+// How long the starter may stay silent before a round is declared drained.
+#define DRAIN_TIMEOUT_MS 10000
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: stress_update [-n concurrent] [-r rounds] [-l latency_ms] [-p processes] [-u nss_delay_ms] [-D] [-v] [-- plugin options]\n");
+    exit(1);
+}
+
+// The stand-in for NSS: the harness's own passwd file, after a delay.  The
+// plugin is linked into this program, so this getpwuid_r is the one it calls.
+static std::string nss_passwd;
+static long nss_delay_ms = 0;
+
+extern "C" int getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t buflen, struct passwd **result) {
+    *result = NULL;
+    poll(NULL, 0, nss_delay_ms);
+    FILE *fp = fopen(nss_passwd.c_str(), "r");
+    if (!fp) {
+        return errno;
+    }
+    int rc;
+    while (((rc = fgetpwent_r(fp, pwd, buf, buflen, result)) == 0) && ((*result)->pw_uid != uid)) {
+        *result = NULL;
+    }
+    fclose(fp);
+    // Running off the end of the file is "not found", not an error.
+    return (rc == ENOENT) ? 0 : rc;
+}
+
+// The starter: one connection and one request at a time.
+struct ChirpServer {
+    int listen_fd;
+    long latency_us;
+    pthread_mutex_t lock;
+    unsigned long connections;
+    unsigned long updates;
+    unsigned long queue_total; // Sum over connections of the queue seen at accept.
+    unsigned queue_max;
+    double last_update;
+};
+
+static void serve_connection(ChirpServer *server, int fd) {
+    char buf[4096];
+    size_t len = 0;
+    bool authenticated = false;
+    while (true) {
+        char *eol;
+        while ((eol = (char *)memchr(buf, '\n', len)) == NULL) {
+            ssize_t bytes = read(fd, buf + len, sizeof(buf) - len);
+            if (bytes <= 0) {
+                return;
+            }
+            len += bytes;
+        }
+        *eol = '\0';
+        const char *reply = "-1\n";
+        if (!strncmp(buf, "cookie ", 7)) {
+            authenticated = !strcmp(buf + 7, CHIRP_COOKIE);
+            reply = authenticated ? "0\n" : "-1\n";
+        } else if (authenticated && !strncmp(buf, "set_job_attr ", 13)) {
+            struct timespec delay = {server->latency_us / 1000000, (server->latency_us % 1000000) * 1000};
+            nanosleep(&delay, NULL);
+            pthread_mutex_lock(&server->lock);
+            server->updates++;
+            server->last_update = now_us();
+            pthread_mutex_unlock(&server->lock);
+            reply = "0\n";
+        }
+        if (write(fd, reply, strlen(reply)) != (ssize_t)strlen(reply)) {
+            return;
+        }
+        len -= (eol + 1 - buf);
+        memmove(buf, eol + 1, len);
+    }
+}
+
+static void * serve(void *arg) {
+    ChirpServer *server = static_cast<ChirpServer *>(arg);
+    while (true) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+        // For a listening socket, tcpi_unacked is the accept backlog.
+        struct tcp_info info;
+        socklen_t info_len = sizeof(info);
+        unsigned waiting = 0;
+        if (getsockopt(server->listen_fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0) {
+            waiting = info.tcpi_unacked;
+        }
+        pthread_mutex_lock(&server->lock);
+        server->connections++;
+        server->queue_total += waiting + 1;
+        server->queue_max = std::max(server->queue_max, waiting + 1);
+        pthread_mutex_unlock(&server->lock);
+        serve_connection(server, fd);
+        close(fd);
+    }
+}
+
+static int start_server(ChirpServer &server, const std::string &config) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (((server.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) ||
+        (bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+        (listen(server.listen_fd, 1024) == -1) ||
+        (getsockname(server.listen_fd, (struct sockaddr *)&addr, &addr_len) == -1)) {
+        perror("Unable to start the Chirp server");
+        return -1;
+    }
+    FILE *fp = fopen(config.c_str(), "w");
+    if (!fp) {
+        perror("Unable to write the chirp config");
+        return -1;
+    }
+    fprintf(fp, "127.0.0.1 %d %s\n", ntohs(addr.sin_port), CHIRP_COOKIE);
+    fclose(fp);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve, &server)) {
+        fprintf(stderr, "Unable to start the Chirp server thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+struct WorkerResult {
+    double latency_us;
+    int rc;
+};
+
+// One glexec invocation: wait for the start signal, then run the plugin.
+static void run_worker(int start_fd, int result_fd, std::vector<char *> &plugin_argv, const char *username, bool verbose) {
+    char dn[] = "/DC=org/DC=example/CN=Stress Test";
+    char *dn_value = dn;
+    char *username_value = (char *)username;
+    lcmaps_argument_t args[] = {
+        {(char *)"user_dn", (char *)"char *", 1, &dn_value},
+        {(char *)"requested_username", (char *)"char *", 1, &username_value},
+        {NULL, NULL, -1, NULL}
+    };
+    WorkerResult result;
+    char go;
+    if (!verbose) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, 2);
+        close(null_fd);
+    }
+    if (read(start_fd, &go, 1) < 0) {
+        _exit(1);
+    }
+    result.rc = plugin_initialize(plugin_argv.size(), &plugin_argv[0]);
+    double start = now_us();
+    if (result.rc == LCMAPS_MOD_SUCCESS) {
+        result.rc = plugin_run(2, args);
+    }
+    result.latency_us = now_us() - start;
+    plugin_terminate();
+    _exit(write(result_fd, &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction) {
+    size_t idx = (size_t)(fraction * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max(idx, (size_t)1)) - 1];
+}
+
+// Runs condor_discovery_daemon on the fake tree, with its events read from
+// a pipe; returns the write end, or -1.
+static int start_daemon(const FakeProcTree &tree, const std::string &socket_path, pid_t *daemon_pid) {
+    int events[2];
+    struct stat st;
+    if (pipe(events) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(events[0], 0);
+        close(events[0]);
+        close(events[1]);
+        execl(CONDOR_DISCOVERY_DAEMON_PATH, "condor_discovery_daemon", "--proc-root", tree.root.c_str(),
+              "--replay", "-", "--socket", socket_path.c_str(), (char *)NULL);
+        perror("Unable to run " CONDOR_DISCOVERY_DAEMON_PATH);
+        _exit(127);
+    }
+    close(events[0]);
+    if (pid == -1) {
+        perror("fork");
+        close(events[1]);
+        return -1;
+    }
+    for (unsigned tries = 0; (tries < 500) && stat(socket_path.c_str(), &st); tries++) {
+        poll(NULL, 0, 10);
+    }
+    if (stat(socket_path.c_str(), &st)) {
+        fprintf(stderr, "The discovery daemon did not start\n");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        close(events[1]);
+        return -1;
+    }
+    *daemon_pid = pid;
+    return events[1];
+}
+
+static unsigned long read_counter(const std::string &path, const char *name) {
+    char line[256];
+    unsigned long value = 0;
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(name);
+        if (!strncmp(line, name, len) && (line[len] == ' ')) {
+            value = strtoul(line + len + 1, NULL, 10);
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    FakeProcOptions opts;
+    unsigned concurrent = 64, rounds = 3;
+    long latency_ms = 5;
+    bool verbose = false, use_daemon = false;
+    int opt;
+
+    opts.processes = 200;
+    opts.cgroup_version = 0;
+    opts.make_execute = true;
+    while ((opt = getopt(argc, argv, "n:r:l:p:u:Dv")) != -1) {
+        switch (opt) {
+        case 'n': concurrent = strtoul(optarg, NULL, 10); break;
+        case 'r': rounds = strtoul(optarg, NULL, 10); break;
+        case 'l': latency_ms = atol(optarg); break;
+        case 'p': opts.processes = strtoul(optarg, NULL, 10); break;
+        case 'u': nss_delay_ms = atol(optarg); break;
+        case 'D': use_daemon = true; break;
+        case 'v': verbose = true; break;
+        default: usage();
+        }
+    }
+    if (!concurrent || !rounds || (opts.processes < opts.depth + 5)) {
+        usage();
+    }
+
+    // The payload runs as whoever runs the harness, so the plugin's switch to
+    // the payload's UID/GID works without root.  Root would be taken for the
+    // starter, so as root the payload runs as nobody.
+    struct passwd *nobody = getuid() ? NULL : getpwnam("nobody");
+    if (!getuid() && !nobody) {
+        fprintf(stderr, "Running as root, but there is no user nobody to run the payload as\n");
+        return 1;
+    }
+    opts.user_uid = standalone_uid = nobody ? nobody->pw_uid : getuid();
+    opts.user_gid = standalone_gid = nobody ? nobody->pw_gid : getgid();
+    FakeProcTree tree;
+    if (makeFakeProc(opts, tree)) {
+        perror("Unable to create the synthetic proc tree");
+        return 1;
+    }
+    std::string scratch = tree.execute_dir + "/dir_" + std::to_string(tree.starter);
+    if ((chmod(tree.root.c_str(), 0755) == -1) || (chown(scratch.c_str(), opts.user_uid, opts.user_gid) == -1)) {
+        perror("Unable to hand the scratch directory to the payload user");
+        removeFakeProc(tree);
+        return 1;
+    }
+    const char *username = nobody ? "nobody" : "stress";
+    nss_passwd = tree.root + "/passwd";
+    FILE *passwd = fopen(nss_passwd.c_str(), "w");
+    if (!passwd) {
+        perror("Unable to write the passwd file");
+        removeFakeProc(tree);
+        return 1;
+    }
+    fprintf(passwd, "%s:x:%u:%u:Stress test payload:/:/bin/false\n", username, opts.user_uid, opts.user_gid);
+    fclose(passwd);
+    std::string config = scratch + "/.chirp.config";
+    std::string stats_path = tree.root + "/stats";
+    ChirpServer server;
+    memset(&server, 0, sizeof(server));
+    server.latency_us = latency_ms * 1000;
+    if (start_server(server, config)) {
+        removeFakeProc(tree);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::string> plugin_args;
+    plugin_args.push_back("lcmaps_condor_update.mod");
+    plugin_args.push_back("-proc-root");
+    plugin_args.push_back(tree.root);
+    plugin_args.push_back("-cgroup");
+    plugin_args.push_back("off");
+    plugin_args.push_back("-stats-file");
+    plugin_args.push_back(stats_path);
+    std::string daemon_socket = tree.root + "/discovery.sock";
+    pid_t daemon_pid = -1;
+    int daemon_events = -1;
+    if (use_daemon) {
+        if ((daemon_events = start_daemon(tree, daemon_socket, &daemon_pid)) == -1) {
+            removeFakeProc(tree);
+            return 1;
+        }
+        plugin_args.push_back("-discovery-daemon");
+        plugin_args.push_back(daemon_socket);
+    }
+    std::string drop_path;
+    for (int idx = optind; idx < argc; idx++) {
+        plugin_args.push_back(argv[idx]);
+        if ((idx + 1 < argc) && !strcasecmp(argv[idx], "-backend") && !strcasecmp(argv[idx + 1], "file-drop")) {
+            drop_path = scratch + "/.lcmaps_update.ad";
+        }
+    }
+    for (int idx = optind; !drop_path.empty() && (idx + 1 < argc); idx++) {
+        if (!strcasecmp(argv[idx], "-drop-file")) {
+            drop_path = scratch + "/" + argv[idx + 1];
+        }
+    }
+    std::vector<char *> plugin_argv;
+    for (size_t idx = 0; idx < plugin_args.size(); idx++) {
+        plugin_argv.push_back(&plugin_args[idx][0]);
+    }
+
+    // The glexec processes are children of the payload at the bottom of the
+    // fake chain, alongside the fake glexec.
+    pid_t payload = tree.leaf - 1;
+    std::vector<double> latencies;
+    unsigned failures = 0;
+    double drain_total = 0;
+    int rc = 0;
+    for (unsigned round = 0; round < rounds && !rc; round++) {
+        int start_pipe[2], result_pipe[2];
+        if ((pipe(start_pipe) == -1) || (pipe(result_pipe) == -1)) {
+            perror("pipe");
+            rc = 1;
+            break;
+        }
+        std::vector<pid_t> workers;
+        while (workers.size() < concurrent) {
+            pid_t pid = fork();
+            if (pid == -1) {
+                perror("fork");
+                rc = 1;
+                break;
+            } else if (pid == 0) {
+                close(start_pipe[1]);
+                close(result_pipe[0]);
+                run_worker(start_pipe[0], result_pipe[1], plugin_argv, username, verbose);
+            }
+            // A real PID that happens to be taken by the fake tree cannot
+            // stand in for glexec; replace the worker.
+            if (addFakeProcess(tree, pid, payload, opts.user_uid, opts.user_gid, "glexec")) {
+                kill(pid, SIGKILL);
+                waitpid(pid, NULL, 0);
+                continue;
+            }
+            if (use_daemon) {
+                dprintf(daemon_events, "fork %d %d\n", payload, pid);
+            }
+            workers.push_back(pid);
+        }
+        close(start_pipe[0]);
+        close(result_pipe[1]);
+        unsigned long updates_before = server.updates;
+        double round_start = now_us();
+        close(start_pipe[1]); // Go.
+
+        WorkerResult result;
+        while (read(result_pipe[0], &result, sizeof(result)) == sizeof(result)) {
+            latencies.push_back(result.latency_us);
+            failures += (result.rc != LCMAPS_MOD_SUCCESS);
+        }
+        close(result_pipe[0]);
+        for (size_t idx = 0; idx < workers.size(); idx++) {
+            waitpid(workers[idx], NULL, 0);
+            removeFakeProcess(tree, workers[idx]);
+            if (use_daemon) {
+                dprintf(daemon_events, "exit %d\n", workers[idx]);
+            }
+        }
+
+        // The updates themselves are sent by daemonized children; wait for
+        // the starter to go quiet.  Dropped files are written before
+        // plugin_run returns.
+        unsigned long seen = updates_before;
+        double quiet_since = now_us();
+        while (drop_path.empty() && (now_us() - quiet_since < DRAIN_TIMEOUT_MS * 1000.0)) {
+            poll(NULL, 0, std::max(latency_ms, 1L) * 4);
+            pthread_mutex_lock(&server.lock);
+            unsigned long updates = server.updates;
+            double last = server.last_update;
+            pthread_mutex_unlock(&server.lock);
+            if (updates == seen) {
+                if ((updates > updates_before) && (now_us() - last > (latency_ms + 50) * 1000.0)) {
+                    drain_total += last - round_start;
+                    break;
+                }
+            } else {
+                seen = updates;
+                quiet_since = now_us();
+            }
+        }
+    }
+
+    if (use_daemon) {
+        kill(daemon_pid, SIGTERM);
+        waitpid(daemon_pid, NULL, 0);
+        close(daemon_events);
+    }
+    if (latencies.empty()) {
+        fprintf(stderr, "No invocation completed\n");
+        removeFakeProc(tree);
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    struct stat st;
+    std::string execs_path = config + ".execs";
+    unsigned long execs = (stat(execs_path.c_str(), &st) == 0) ? st.st_size : 0;
+    pthread_mutex_lock(&server.lock);
+    unsigned long daemon_hits = read_counter(stats_path, "daemon_hits");
+    printf("%10s %6s %8s %10s %10s %10s %6s %6s %8s %6s %8s %10s %6s %6s\n", "concurrent", "rounds", "latency",
+           "p50 (us)", "p99 (us)", "max (us)", "forks", "execs", "updates", "queue", "mean q", "drain (ms)", "uhits", "dhits");
+    printf("%10u %6u %8ld %10.0f %10.0f %10.0f %6lu %6lu %8lu %6u %8.1f %10.1f %6lu %6lu\n", concurrent, rounds, latency_ms,
+           percentile(latencies, 0.5), percentile(latencies, 0.99), latencies.back(),
+           read_counter(stats_path, "forks"), execs, server.updates, server.queue_max,
+           server.connections ? (double)server.queue_total / server.connections : 0.0, drain_total / rounds / 1e3,
+           read_counter(stats_path, "user_cache_hits"), daemon_hits);
+    pthread_mutex_unlock(&server.lock);
+    // Saves that found the statistics file busy are not counted at all.
+    unsigned long saved = read_counter(stats_path, "invocations");
+    if (!failures && (saved < latencies.size())) {
+        printf("Statistics saved for %lu of %lu invocations; the file was busy for the rest\n", saved, (unsigned long)latencies.size());
+    }
+    if (use_daemon && (daemon_hits != saved)) {
+        fprintf(stderr, "The discovery daemon answered %lu of %lu lookups\n", daemon_hits, saved);
+        rc = 1;
+    }
+    if (!drop_path.empty()) {
+        char line[1024];
+        unsigned lines = 0;
+        bool has_user = false;
+        FILE *fp = fopen(drop_path.c_str(), "r");
+        while (fp && fgets(line, sizeof(line), fp)) {
+            lines++;
+            has_user |= !strncmp(line, "glexec_user = ", 14);
+        }
+        if (fp) {
+            fclose(fp);
+        }
+        printf("Drop file %s: %u attributes\n", drop_path.c_str(), lines);
+        if (!has_user) {
+            fprintf(stderr, "Drop file %s is missing or has no glexec_user\n", drop_path.c_str());
+            rc = 1;
+        }
+    }
+    if (failures) {
+        fprintf(stderr, "%u of %lu invocations failed\n", failures, (unsigned long)latencies.size());
+        rc = 1;
+    }
+    removeFakeProc(tree);
+    return rc;
+}
@@ -0,0 +1,217 @@
+
+/*
+ * lcmaps-condor-update
+ * Per-job record of the attributes already sent; see update_state.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <linux/limits.h>
+
+#include "lcmaps/lcmaps_modules.h"
+
+#include "update_state.h"
+#include "log_limit.h"
+
+static const char * logstr = "lcmaps-condor-update";
+
+int update_state_lock(const char *path) {
+  char lock_path[PATH_MAX];
+  int fd, locked, tries = 0;
+
+  if (snprintf(lock_path, PATH_MAX, "%s%s", path, UPDATE_STATE_LOCK_SUFFIX) >= PATH_MAX) {
+    return -1;
+  }
+  // A separate file: the state file itself is replaced on every save, which
+  // would leave a lock on it behind on the old inode.
+  if ((fd = open(lock_path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1) {
+    limited_log(0, "%s: Unable to open update state lock %s: %d %s\n", logstr, lock_path, errno, strerror(errno));
+    return -1;
+  }
+  // The holder keeps the lock while it talks to the starter, so do not wait
+  // for it; without the lock, this invocation simply sends everything.
+  while (((locked = flock(fd, LOCK_EX | LOCK_NB)) == -1) && (errno == EWOULDBLOCK) && (++tries < UPDATE_STATE_LOCK_TRIES)) {
+    usleep(1000);
+  }
+  if (locked == -1) {
+    if (errno == EWOULDBLOCK) {
+      lcmaps_log_debug(2, "%s: Update state %s is busy; not suppressing updates.\n", logstr, path);
+    } else {
+      limited_log(0, "%s: Unable to lock update state %s: %d %s\n", logstr, lock_path, errno, strerror(errno));
+    }
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void update_state_load(const char *path, update_state_t *state) {
+  char *next, *line;
+  ssize_t bytes;
+  int fd;
+
+  state->count = 0;
+  if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+    return;
+  }
+  bytes = read(fd, state->buf, UPDATE_STATE_SIZE - 1);
+  close(fd);
+  if (bytes <= 0) {
+    return;
+  }
+  state->buf[bytes] = '\0';
+
+  next = state->buf;
+  while ((line = strsep(&next, "\n")) && (state->count < UPDATE_STATE_MAX_ENTRIES)) {
+    update_state_entry_t *entry = &state->entries[state->count];
+    char *end;
+    entry->when = strtol(line, &end, 10);
+    if ((end == line) || (*end != ' ')) {
+      continue;
+    }
+    entry->attr = end + 1;
+    if ((end = strchr(entry->attr, ' ')) == NULL) {
+      continue;
+    }
+    *end = '\0';
+    entry->val = end + 1;
+    state->count++;
+  }
+}
+
+const update_state_entry_t * update_state_find(const update_state_t *state, const char *attr) {
+  size_t idx;
+  for (idx = 0; idx < state->count; idx++) {
+    if (strcmp(state->entries[idx].attr, attr) == 0) {
+      return &state->entries[idx];
+    }
+  }
+  return NULL;
+}
+
+static int append_entry(char *buf, size_t *len, const char *attr, const char *val, time_t when) {
+  // Values are single-line ClassAd expressions; anything else is not recorded
+  // and so will simply be sent every time.
+  if (strchr(attr, ' ') || strchr(attr, '\n') || strchr(val, '\n')) {
+    return 0;
+  }
+  int bytes = snprintf(buf + *len, UPDATE_STATE_SIZE - *len, "%ld %s %s\n", (long)when, attr, val);
+  if ((bytes < 0) || (*len + bytes >= UPDATE_STATE_SIZE)) {
+    return -1;
+  }
+  *len += bytes;
+  return 0;
+}
+
+int update_state_save(const char *path, const update_state_t *state, const classad_update_t *sent, size_t count, time_t now) {
+  char buf[UPDATE_STATE_SIZE];
+  char tmp_path[PATH_MAX];
+  size_t len = 0, idx, sent_idx;
+  int fd;
+
+  for (idx = 0; idx < state->count; idx++) {
+    const update_state_entry_t *entry = &state->entries[idx];
+    for (sent_idx = 0; sent_idx < count; sent_idx++) {
+      if (strcmp(entry->attr, sent[sent_idx].attr) == 0) break;
+    }
+    if ((sent_idx == count) && append_entry(buf, &len, entry->attr, entry->val, entry->when)) {
+      return -1;
+    }
+  }
+  for (sent_idx = 0; sent_idx < count; sent_idx++) {
+    if (append_entry(buf, &len, sent[sent_idx].attr, sent[sent_idx].val, now)) {
+      return -1;
+    }
+  }
+
+  // Write a temporary file and rename it over the old one, so a concurrent
+  // reader never sees a partial file.
+  if (snprintf(tmp_path, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX) {
+    return -1;
+  }
+  if ((fd = mkostemp(tmp_path, O_CLOEXEC)) == -1) {
+    limited_log(0, "%s: Unable to create update state file %s: %d %s\n", logstr, tmp_path, errno, strerror(errno));
+    return -1;
+  }
+  if (write(fd, buf, len) != (ssize_t)len) {
+    limited_log(0, "%s: Unable to write update state file %s: %d %s\n", logstr, tmp_path, errno, strerror(errno));
+    close(fd);
+    unlink(tmp_path);
+    return -1;
+  }
+  close(fd);
+  if (rename(tmp_path, path) == -1) {
+    limited_log(0, "%s: Unable to replace update state file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+// Bump the last byte when the layout changes; a file with another layout
+// starts the history over.
+#define HISTORY_MAGIC 0x4c434801U
+
+static uint32_t user_hash(const char *user) {
+  uint32_t hash = 2166136261U; // FNV-1a
+  for (; *user; user++) {
+    hash = (hash ^ (unsigned char)*user) * 16777619U;
+  }
+  return hash ? hash : 1;
+}
+
+// Returns 1 if user had not been seen before (or cannot be remembered).
+static int add_user(update_history_t *history, const char *user) {
+  uint32_t hash = user_hash(user);
+  size_t idx = (hash * 2654435769U) >> 24;
+  for (;; idx = (idx + 1) % UPDATE_HISTORY_SLOTS) {
+    if (history->users[idx] == hash) {
+      return 0;
+    }
+    if (history->users[idx] == 0) {
+      break;
+    }
+  }
+  if (history->distinct_users < UPDATE_HISTORY_MAX_USERS) {
+    history->users[idx] = hash;
+  }
+  return 1;
+}
+
+int update_history_record(const char *path, const char *user, time_t now, update_history_t *history) {
+  ssize_t bytes;
+  int fd, result = 0;
+
+  if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1) {
+    limited_log(0, "%s: Unable to open history file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    return -1;
+  }
+  if (flock(fd, LOCK_EX) == -1) {
+    limited_log(0, "%s: Unable to lock history file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  bytes = pread(fd, history, sizeof(*history), 0);
+  if ((bytes != sizeof(*history)) || (history->magic != HISTORY_MAGIC)) {
+    memset(history, 0, sizeof(*history));
+    history->magic = HISTORY_MAGIC;
+    history->first_time = now;
+  }
+  history->count++;
+  history->distinct_users += add_user(history, user);
+  if (pwrite(fd, history, sizeof(*history), 0) != sizeof(*history)) {
+    limited_log(0, "%s: Unable to write history file %s: %d %s\n", logstr, path, errno, strerror(errno));
+    result = -1;
+  }
+  close(fd); // Releases the lock.
+  return result;
+}
@@ -0,0 +1,90 @@
+#ifndef __UPDATE_STATE_H
+#define __UPDATE_STATE_H
+
+/*
+ * Remembers, per job, the attribute values last pushed to the starter, so an
+ * invocation of glexec for the same payload user can skip the Chirp traffic.
+ * The state file sits next to the job's chirp config and is only ever read
+ * and written by the job's own user.  Format, one attribute per line:
+ *   <unix time> <attribute> <value>
+ */
+
+#include <time.h>
+#include <stdint.h>
+
+#include "starter_update.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPDATE_STATE_SUFFIX ".lcmaps_update"
+#define UPDATE_STATE_LOCK_SUFFIX ".lock"
+#define UPDATE_STATE_LOCK_TRIES 10
+#define UPDATE_STATE_MAX_ENTRIES 16
+#define UPDATE_STATE_SIZE 8192
+
+typedef struct {
+  const char *attr;
+  const char *val;
+  time_t when;
+} update_state_entry_t;
+
+typedef struct {
+  char buf[UPDATE_STATE_SIZE];
+  size_t count;
+  update_state_entry_t entries[UPDATE_STATE_MAX_ENTRIES];
+} update_state_t;
+
+/* Take an exclusive flock on the sidecar lock file of the state file at
+   path, retrying for a few milliseconds only.  The lock must be held from
+   the load through the save, so that concurrent invocations neither both
+   skip nor both send an attribute, nor drop each other's records; it is
+   released when the returned descriptor is closed.  Returns -1 if the lock
+   is busy or cannot be taken. */
+int update_state_lock(const char *path);
+
+/* Load the state file at path; a missing or unreadable file gives an empty
+   state.  Entries point into state->buf. */
+void update_state_load(const char *path, update_state_t *state);
+
+/* The last recorded update of attr, or NULL. */
+const update_state_entry_t * update_state_find(const update_state_t *state, const char *attr);
+
+/* Atomically replace the file at path with state, updated with the count
+   attributes in sent as of now.  Returns 0 on success. */
+int update_state_save(const char *path, const update_state_t *state, const classad_update_t *sent, size_t count, time_t now);
+
+/*
+ * Running totals over every invocation for the job, kept in a second file
+ * next to the chirp config: how many times glexec ran, since when, and for
+ * how many distinct users.  The file has a fixed size and is updated in
+ * place under flock, so concurrent invocations neither lose counts nor pay
+ * for a longer history.  Users are remembered as 32-bit hashes in an
+ * open-addressed table; past UPDATE_HISTORY_MAX_USERS distinct users, a
+ * user is counted again every time, so the count becomes an upper bound.
+ */
+
+#define UPDATE_HISTORY_SUFFIX ".lcmaps_history"
+#define UPDATE_HISTORY_SLOTS 256
+#define UPDATE_HISTORY_MAX_USERS 192
+
+typedef struct {
+  uint32_t magic;
+  uint32_t count;          // Invocations recorded.
+  int64_t first_time;      // Time of the first one.
+  uint32_t distinct_users;
+  uint32_t reserved;
+  uint32_t users[UPDATE_HISTORY_SLOTS]; // User hashes; 0 is a free slot.
+} update_history_t;
+
+/* Count an invocation by user at now in the history file at path, creating
+   it if needed, and return the updated totals in history.  Returns 0 on
+   success. */
+int update_history_record(const char *path, const char *user, time_t now, update_history_t *history);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
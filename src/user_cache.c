@@ -0,0 +1,110 @@
+
+/*
+ * lcmaps-condor-update
+ * Node-wide user name cache; see user_cache.h.
+ * This code is under the public domain
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "discovery_cache.h"
+#include "user_cache.h"
+
+#define USER_CACHE_MAGIC 0x4c435501U
+#define USER_CACHE_SLOTS 256
+#define USER_CACHE_SLOT_BITS 8
+#define USER_CACHE_READ_TRIES 4
+
+typedef struct {
+  volatile uint32_t seq; // Odd while a writer is updating the slot.
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t used;         // 0 for an empty slot.
+  int64_t stored;        // When the entry was looked up in NSS.
+  char name[USER_CACHE_NAME_LEN];
+} user_slot_t;
+
+typedef struct {
+  volatile uint32_t magic;
+  uint32_t reserved;
+  user_slot_t slots[USER_CACHE_SLOTS];
+} user_file_t;
+
+static user_file_t *users = NULL;
+
+static user_slot_t * user_slot(uid_t uid) {
+  return &users->slots[((uint32_t)uid * 2654435769U) >> (32 - USER_CACHE_SLOT_BITS)];
+}
+
+int user_cache_open(const char *path) {
+  user_cache_close();
+  users = (user_file_t *)cache_file_map(path, sizeof(user_file_t), USER_CACHE_MAGIC, "user cache");
+  return users ? 0 : -1;
+}
+
+void user_cache_close(void) {
+  if (users) {
+    munmap(users, sizeof(user_file_t));
+    users = NULL;
+  }
+}
+
+int user_cache_lookup(uid_t uid, time_t now, long ttl, char *name, size_t len, gid_t *gid) {
+  user_slot_t *slot, copy;
+  uint32_t seq;
+  int tries;
+
+  if (!users) {
+    return -1;
+  }
+  slot = user_slot(uid);
+  for (tries = 0; tries < USER_CACHE_READ_TRIES; tries++) {
+    seq = slot->seq;
+    __sync_synchronize();
+    if (seq & 1) {
+      continue;
+    }
+    memcpy(&copy, slot, sizeof(copy));
+    __sync_synchronize();
+    if (slot->seq != seq) {
+      continue;
+    }
+    // An entry from the future (the clock was set back) is not trusted either.
+    if (!copy.used || (copy.uid != uid) || (now - copy.stored >= ttl) || (copy.stored > now) ||
+        (memchr(copy.name, '\0', sizeof(copy.name)) == NULL) || (strlen(copy.name) >= len)) {
+      return -1;
+    }
+    strcpy(name, copy.name);
+    *gid = copy.gid;
+    return 0;
+  }
+  return -1;
+}
+
+void user_cache_store(uid_t uid, const char *name, gid_t gid, time_t now) {
+  user_slot_t *slot;
+  uint32_t seq;
+
+  if (!users || (strlen(name) >= USER_CACHE_NAME_LEN)) {
+    return;
+  }
+  slot = user_slot(uid);
+  seq = slot->seq;
+  // As in the discovery cache, the compare-and-swap is the writers' lock.
+  if ((seq & 1) || !__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1)) {
+    return;
+  }
+  slot->uid = uid;
+  slot->gid = gid;
+  slot->used = 1;
+  slot->stored = now;
+  memset(slot->name, 0, sizeof(slot->name));
+  strcpy(slot->name, name);
+  __sync_synchronize();
+  slot->seq = seq + 2;
+}
@@ -0,0 +1,38 @@
+#ifndef __USER_CACHE_H
+#define __USER_CACHE_H
+
+/*
+ * Node-wide cache of user names (and primary GIDs) by UID, so a mapping does
+ * not wait on NSS (sssd, LDAP) for a user the node has seen recently.  It
+ * lives in a memory-mapped file with the same checks and the same sequence
+ * locking as the discovery cache (see discovery_cache.h).  Entries expire
+ * after a TTL given at lookup, so a renamed account is picked up again.
+ */
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longer names are not cached.
+#define USER_CACHE_NAME_LEN 64
+
+/* Returns 0 on success; on failure the cache is simply not used. */
+int user_cache_open(const char *path);
+
+void user_cache_close(void);
+
+/* Look up uid in an entry stored less than ttl seconds before now.  Returns
+   0 and fills in the name and primary GID on a hit. */
+int user_cache_lookup(uid_t uid, time_t now, long ttl, char *name, size_t len, gid_t *gid);
+
+void user_cache_store(uid_t uid, const char *name, gid_t gid, time_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif